@@ -1,24 +1,27 @@
 
 # include "attention_common.hpp"
+# include "attention_trace.hpp"
 
 # include <vector>
 # include <cmath>
 # include <algorithm>
 #include <random>
 #include <map>
+#include <stdexcept>
 
 using namespace std;
 
 /*LOGIC FOR:
 
 1] transpose(m)
-2] matmul (mat A, mat B)
+2] matmul (mat A, mat B) / matmulInto (mat A, mat B, head view)
 3] softmax (m)
 4] createMatrix(r, c, val)
 5] printMatrix(m)
 6] text-2-Embedding ("xyz...", emb_size)
 7] embedding-2-text ([[0.2, 0.4...], [...]] => embedding)
-8] calculateMemoryKB(m)
+8] maxAbsDiff(mat A, mat B)
+9] calculateMemoryKB(m)
 
 */
 
@@ -27,6 +30,7 @@ vector<vector<float>> AttentionCommon::transpose(const vector<vector<float>> &M)
         return {};
     }
     std::vector<std::vector<float>> result(M[0].size(), std::vector<float>(M.size()));
+    ATTN_TRACE_ALLOC(M.size() * M[0].size() * sizeof(float));
     for(int i = 0 ; i < M.size() ; ++i){
         for(int j = 0 ; j < M[0].size() ; ++j){
             result[j][i] = M[i][j];
@@ -40,6 +44,7 @@ vector<vector<float>> AttentionCommon::matmul(const vector<vector<float>> &A, co
 
     // prod matrix size : (p x r)
     std::vector<std::vector<float>> result(A_rows, std::vector<float>(B_cols, 0.0f));
+    ATTN_TRACE_ALLOC(static_cast<size_t>(A_rows) * B_cols * sizeof(float));
 
     for(int i = 0 ; i < result.size() ; ++i){
         for(int j = 0 ; j < result[0].size() ; ++j){
@@ -50,10 +55,31 @@ vector<vector<float>> AttentionCommon::matmul(const vector<vector<float>> &A, co
     }return result;
 }
 
+void AttentionCommon::matmulInto(const vector<vector<float>> &A, const vector<vector<float>> &B, const HeadView &out){
+    int A_rows = A.size(), A_cols = A[0].size();     // (p x q)
+    int B_cols = B[0].size();                        // (q x r), r == out.width
+
+    // a wider B or a taller A would write into the next head's columns or past the last row
+    if(static_cast<int>(B.size()) != A_cols || B_cols != out.width || A_rows > out.rows()){
+        throw invalid_argument("matmulInto: product does not fit the head view");
+    }
+
+    for(int i = 0 ; i < A_rows ; ++i){
+        for(int j = 0 ; j < B_cols ; ++j){
+            float acc = 0.0f;
+            for(int k = 0 ; k < A_cols ; ++k){
+                acc += (A[i][k] * B[k][j]);
+            }
+            out(i, j) = acc;
+        }
+    }
+}
+
 std::vector<std::vector<float>> AttentionCommon::softmax(const std::vector<std::vector<float>>& M){
     vector<vector<float>> result = M;
     int rows = M.size();
     int cols = M[0].size();
+    ATTN_TRACE_ALLOC(static_cast<size_t>(rows) * cols * sizeof(float));
 
     for(int i = 0 ; i < rows ; ++i){
         float max_val = -1e9;
@@ -78,6 +104,7 @@ std::vector<std::vector<float>> AttentionCommon::softmax(const std::vector<std::
 
 vector<vector<float>> AttentionCommon::createMatrix(int rows, int cols, float value){
     vector<vector<float>> result(rows, vector<float>(cols, value));
+    ATTN_TRACE_ALLOC(static_cast<size_t>(rows) * cols * sizeof(float));
     return result;
 }
 
@@ -133,6 +160,22 @@ std::string AttentionCommon::embeddingToText(const std::vector<std::vector<float
     return result;
 }
 
+float AttentionCommon::maxAbsDiff(const vector<vector<float>> &A, const vector<vector<float>> &B){
+    float max_diff = 0.0f;
+    if(A.size() != B.size()){
+        throw invalid_argument("maxAbsDiff: matrices have a different number of rows");
+    }
+    for(size_t i = 0 ; i < A.size() ; ++i){
+        if(A[i].size() != B[i].size()){
+            throw invalid_argument("maxAbsDiff: matrices have a different number of columns");
+        }
+        for(size_t j = 0 ; j < A[i].size() ; ++j){
+            max_diff = max(max_diff, abs(A[i][j] - B[i][j]));
+        }
+    }
+    return max_diff;
+}
+
 size_t AttentionCommon::calculateMemoryKB(const std::vector<std::vector<float>>& M){
     if(M.empty()) { return 0; }
     size_t total_elements = (M.size() * M[0].size());
@@ -9,12 +9,27 @@
 # include <iostream>
 # include <memory>
 
+/* Strided view of one head inside a [seq, H, d_head] buffer (stored as seq rows of H * d_head).
+   Row i of head h lives at columns [h * d_head, (h + 1) * d_head) of row i, so heads are
+   split and merged without copying. Writers check their output against width and rows(). */
+struct HeadView{
+    std::vector<std::vector<float>> *data;
+    int offset;
+    int width;
+
+    int rows() const { return static_cast<int>(data->size()); }
+    float &operator()(int i, int j) const { return (*data)[i][offset + j]; }
+};
+
 class AttentionCommon{
     public:
         static std::vector<std::vector<float>> transpose(const std::vector<std::vector<float>> &M);
         
         static std::vector<std::vector<float>> matmul(const std::vector<std::vector<float>> &A, const std::vector<std::vector<float>> &B);
 
+        // writes (A x B) straight into a head slice, no temporary
+        static void matmulInto(const std::vector<std::vector<float>> &A, const std::vector<std::vector<float>> &B, const HeadView &out);
+
         static std::vector<std::vector<float>> softmax(const std::vector<std::vector<float>> &M);
 
         static std::vector<std::vector<float>> createMatrix(int rows, int cols, float value = 0.0f);
@@ -25,6 +40,9 @@ class AttentionCommon{
 
         static std::string embeddingToText(const std::vector<std::vector<float>> &embedding);
 
+        // largest element-wise |A - B| (accuracy checks between two forward paths)
+        static float maxAbsDiff(const std::vector<std::vector<float>> &A, const std::vector<std::vector<float>> &B);
+
         // to calculate memory
         static size_t calculateMemoryKB(const std::vector<std::vector<float>> &M);
 }; 
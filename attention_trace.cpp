@@ -0,0 +1,204 @@
+# include "attention_trace.hpp"
+
+# include <atomic>
+# include <chrono>
+# include <fstream>
+# include <iostream>
+# include <iomanip>
+# include <map>
+# include <memory>
+# include <mutex>
+# include <tuple>
+# include <vector>
+
+using namespace std;
+
+/*LOGIC FOR:
+
+1] per-thread event buffers (registered once per thread, appended without locking)
+2] begin / end spans => Chrome "X" (complete) events
+3] counters => Chrome "C" events carrying the running value
+4] allocation byte accounting
+5] JSON writer + summary
+
+*/
+
+namespace{
+
+struct TraceEvent{
+    char phase;              // 'X' : complete span, 'C' : counter sample
+    const char *cat;
+    const char *name;
+    int head;
+    double ts_us;
+    double dur_us;           // 'X' only
+    double value;            // 'C' only
+};
+
+struct ThreadBuffer{
+    int tid;
+    vector<TraceEvent> events;
+    map<tuple<const char*, const char*, int>, double> counters;
+    size_t alloc_bytes = 0;
+};
+
+mutex registry_mutex;
+vector<shared_ptr<ThreadBuffer>> registry;
+atomic<size_t> total_alloc_bytes(0);
+
+const chrono::steady_clock::time_point trace_epoch = chrono::steady_clock::now();
+
+double nowMicros(){
+    return chrono::duration<double, micro>(chrono::steady_clock::now() - trace_epoch).count();
+}
+
+ThreadBuffer &localBuffer(){
+    // the registry keeps the buffer alive after the thread exits
+    thread_local shared_ptr<ThreadBuffer> buffer;
+    if(!buffer){
+        buffer = make_shared<ThreadBuffer>();
+        buffer->events.reserve(4096);
+        lock_guard<mutex> lock(registry_mutex);
+        buffer->tid = static_cast<int>(registry.size());
+        registry.push_back(buffer);
+    }
+    return *buffer;
+}
+
+void writeJsonString(ostream &out, const char *s){
+    out << '"';
+    for(; *s ; ++s){
+        if(*s == '"' || *s == '\\'){
+            out << '\\';
+        }
+        out << *s;
+    }
+    out << '"';
+}
+
+}
+
+AttentionTrace::ScopedTimer::ScopedTimer(const char *cat, const char *name, int head)
+: span(AttentionTrace::begin(cat, name, head)){}
+
+AttentionTrace::ScopedTimer::~ScopedTimer(){
+    AttentionTrace::end(span);
+}
+
+AttentionTrace::Span AttentionTrace::begin(const char *cat, const char *name, int head){
+    Span span;
+    span.cat = cat;
+    span.name = name;
+    span.head = head;
+    span.start_us = nowMicros();
+    return span;
+}
+
+void AttentionTrace::end(const Span &span){
+    double end_us = nowMicros();
+    localBuffer().events.push_back({'X', span.cat, span.name, span.head, span.start_us, end_us - span.start_us, 0.0});
+}
+
+void AttentionTrace::count(const char *cat, const char *name, int head, double delta){
+    ThreadBuffer &buffer = localBuffer();
+    double &value = buffer.counters[make_tuple(cat, name, head)];
+    value += delta;
+    buffer.events.push_back({'C', cat, name, head, nowMicros(), 0.0, value});
+}
+
+void AttentionTrace::recordAlloc(size_t bytes){
+    ThreadBuffer &buffer = localBuffer();
+    buffer.alloc_bytes += bytes;
+    total_alloc_bytes += bytes;
+    buffer.events.push_back({'C', "memory", "alloc_bytes", -1, nowMicros(), 0.0, static_cast<double>(buffer.alloc_bytes)});
+}
+
+size_t AttentionTrace::allocatedBytes(){
+    return total_alloc_bytes.load();
+}
+
+bool AttentionTrace::writeChromeTrace(const string &path){
+    ofstream out(path);
+    if(!out){
+        cerr << "ERROR: cannot open trace file " << path << endl;
+        return false;
+    }
+
+    lock_guard<mutex> lock(registry_mutex);
+    out << setprecision(15);
+    out << "{\"traceEvents\":[\n";
+    bool first = true;
+
+    for(const auto &buffer : registry){
+        // name the thread track so the per-thread counters are readable
+        out << (first ? "" : ",\n")
+            << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << buffer->tid
+            << ",\"args\":{\"name\":\"thread " << buffer->tid << "\"}}";
+        first = false;
+
+        for(const auto &e : buffer->events){
+            out << ",\n{\"name\":";
+            writeJsonString(out, e.name);
+            out << ",\"cat\":";
+            writeJsonString(out, e.cat);
+            out << ",\"ph\":\"" << e.phase << "\",\"ts\":" << e.ts_us
+                << ",\"pid\":0,\"tid\":" << buffer->tid;
+
+            if(e.phase == 'X'){
+                out << ",\"dur\":" << e.dur_us << ",\"args\":{\"head\":" << e.head << "}}";
+            }else{
+                // one series per head on the same counter track
+                out << ",\"args\":{\"";
+                if(e.head < 0){
+                    out << "total";
+                }else{
+                    out << "head " << e.head;
+                }
+                out << "\":" << e.value << "}}";
+            }
+        }
+    }
+    out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+    return static_cast<bool>(out);
+}
+
+void AttentionTrace::printSummary(){
+    lock_guard<mutex> lock(registry_mutex);
+
+    // (cat, name) => (total us, calls)
+    map<pair<string, string>, pair<double, long long>> stages;
+    size_t alloc_bytes = 0;
+    for(const auto &buffer : registry){
+        for(const auto &e : buffer->events){
+            if(e.phase != 'X'){ continue; }
+            auto &stage = stages[make_pair(string(e.cat), string(e.name))];
+            stage.first += e.dur_us;
+            stage.second += 1;
+        }
+        alloc_bytes += buffer->alloc_bytes;
+    }
+
+    ios::fmtflags old_flags = cout.flags();
+    streamsize old_precision = cout.precision();
+
+    cout << "=== Attention Trace Summary ===\n";
+    for(const auto &stage : stages){
+        cout << stage.first.first << "." << stage.first.second << ": "
+             << fixed << setprecision(1) << stage.second.first << " us ("
+             << stage.second.second << " calls)\n";
+    }
+    cout.flags(old_flags);
+    cout.precision(old_precision);
+    cout << "Allocated: " << (alloc_bytes / 1024) << " KB across " << registry.size() << " thread(s)\n";
+    cout << "===============================\n\n";
+}
+
+void AttentionTrace::reset(){
+    lock_guard<mutex> lock(registry_mutex);
+    for(auto &buffer : registry){
+        buffer->events.clear();
+        buffer->counters.clear();
+        buffer->alloc_bytes = 0;
+    }
+    total_alloc_bytes = 0;
+}
@@ -0,0 +1,79 @@
+# ifndef ATTENTION_TRACE_HPP
+# define ATTENTION_TRACE_HPP
+
+# include <string>
+# include <cstddef>
+
+/* Hot-path instrumentation for the attention variants.
+
+   Compiled out unless ATTENTION_TRACE is defined (g++ -DATTENTION_TRACE ...).
+   Every hook below goes through a macro, so a normal build carries no timers,
+   no counters and no extra branches in forward().
+
+   Events are buffered per thread (no lock on the hot path) and written as
+   Chrome trace-event JSON (open in chrome://tracing or ui.perfetto.dev).
+   writeChromeTrace() / printSummary() must be called while no other thread
+   is still recording.
+*/
+
+class AttentionTrace{
+    public:
+        // handle returned by begin(), closed by end()
+        struct Span{
+            const char *cat;
+            const char *name;
+            int head;
+            double start_us;
+        };
+
+        // RAII form of begin()/end() for whole-function scopes
+        class ScopedTimer{
+            public:
+                ScopedTimer(const char *cat, const char *name, int head = -1);
+                ~ScopedTimer();
+            private:
+                Span span;
+        };
+
+        static Span begin(const char *cat, const char *name, int head = -1);
+        static void end(const Span &span);
+
+        // accumulates 'delta' into the (cat, name, head) counter of the calling thread
+        static void count(const char *cat, const char *name, int head, double delta);
+
+        // bytes handed out for matrices (per thread + process total)
+        static void recordAlloc(size_t bytes);
+        static size_t allocatedBytes();
+
+        static bool writeChromeTrace(const std::string &path);
+
+        // per-stage wall time totals, grouped by variant (cat)
+        static void printSummary();
+
+        static void reset();
+};
+
+# ifdef ATTENTION_TRACE
+
+#  define ATTN_TRACE_CONCAT_(a, b) a##b
+#  define ATTN_TRACE_CONCAT(a, b) ATTN_TRACE_CONCAT_(a, b)
+
+#  define ATTN_TRACE_SCOPE(cat, name, head) \
+        AttentionTrace::ScopedTimer ATTN_TRACE_CONCAT(attn_trace_scope_, __LINE__)(cat, name, head)
+#  define ATTN_TRACE_BEGIN(span, cat, name, head) \
+        const AttentionTrace::Span span = AttentionTrace::begin(cat, name, head)
+#  define ATTN_TRACE_END(span) AttentionTrace::end(span)
+#  define ATTN_TRACE_COUNT(cat, name, head, delta) AttentionTrace::count(cat, name, head, delta)
+#  define ATTN_TRACE_ALLOC(bytes) AttentionTrace::recordAlloc(bytes)
+
+# else
+
+#  define ATTN_TRACE_SCOPE(cat, name, head) ((void)0)
+#  define ATTN_TRACE_BEGIN(span, cat, name, head) ((void)0)
+#  define ATTN_TRACE_END(span) ((void)0)
+#  define ATTN_TRACE_COUNT(cat, name, head, delta) ((void)0)
+#  define ATTN_TRACE_ALLOC(bytes) ((void)0)
+
+# endif
+
+# endif
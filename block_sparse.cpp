@@ -0,0 +1,186 @@
+# include "block_sparse.hpp"
+
+# include <algorithm>
+# include <cmath>
+# include <limits>
+# include <set>
+# include <stdexcept>
+
+using namespace std;
+
+/*LOGIC FOR:
+
+1] BlockIndex::build (pattern => CSR list of key blocks per query block)
+2] BlockIndex::toMask (equivalent dense mask, for reference checks)
+3] BlockSparseAttention::attend (only the listed tiles are scored)
+4] BlockSparseAttention::attendDense (masked dense reference)
+
+*/
+
+BlockIndex BlockIndex::build(const BlockSparsePattern &pattern, int seq_len){
+    if(pattern.block_size <= 0){
+        throw invalid_argument("block_size must be positive");
+    }
+
+    BlockIndex index;
+    index.block_size = pattern.block_size;
+    index.seq_len = seq_len;
+    index.num_blocks = (seq_len + pattern.block_size - 1) / pattern.block_size;
+    index.causal = pattern.causal;
+    int nb = index.num_blocks;
+
+    vector<set<int>> rows(nb);
+    if(!pattern.blocks.empty()){
+        for(const auto &tile : pattern.blocks){
+            if(tile.first < 0 || tile.first >= nb || tile.second < 0 || tile.second >= nb){
+                throw invalid_argument("block layout entry is outside the sequence");
+            }
+            rows[tile.first].insert(tile.second);
+        }
+    }else{
+        vector<int> global_blocks;
+        for(int token : pattern.global_tokens){
+            if(token >= 0 && token < seq_len){
+                global_blocks.push_back(token / pattern.block_size);
+            }
+        }
+
+        for(int qb = 0 ; qb < nb ; ++qb){
+            if(pattern.local_blocks >= 0){
+                for(int kb = max(0, qb - pattern.local_blocks) ; kb <= min(nb - 1, qb + pattern.local_blocks) ; ++kb){
+                    rows[qb].insert(kb);
+                }
+            }
+            if(pattern.stride > 0){
+                for(int kb = qb % pattern.stride ; kb < nb ; kb += pattern.stride){
+                    rows[qb].insert(kb);
+                }
+            }
+            for(int gb : global_blocks){
+                rows[qb].insert(gb);        // everyone reads the global block
+                rows[gb].insert(qb);        // the global block reads everyone
+            }
+        }
+    }
+
+    index.row_ptr.push_back(0);
+    for(int qb = 0 ; qb < nb ; ++qb){
+        for(int kb : rows[qb]){
+            // with causal masking a tile wholly in the future holds nothing
+            if(pattern.causal && kb > qb){ continue; }
+            index.col_idx.push_back(kb);
+        }
+        if(static_cast<int>(index.col_idx.size()) == index.row_ptr.back()){
+            throw invalid_argument("every query block must attend to at least one key block");
+        }
+        index.row_ptr.push_back(index.col_idx.size());
+    }
+    return index;
+}
+
+int BlockIndex::nnzBlocks() const{
+    return col_idx.size();
+}
+
+long long BlockIndex::nnzEntries() const{
+    long long entries = 0;
+    for(int qb = 0 ; qb < num_blocks ; ++qb){
+        for(int p = row_ptr[qb] ; p < row_ptr[qb + 1] ; ++p){
+            int kb = col_idx[p];
+            for(int i = qb * block_size ; i < min(seq_len, (qb + 1) * block_size) ; ++i){
+                int last = min(seq_len, (kb + 1) * block_size) - 1;
+                if(causal){ last = min(last, i); }
+                entries += max(0, last - kb * block_size + 1);
+            }
+        }
+    }
+    return entries;
+}
+
+float BlockIndex::density() const{
+    return (num_blocks == 0) ? 0.0f : static_cast<float>(nnzBlocks()) / (static_cast<float>(num_blocks) * num_blocks);
+}
+
+vector<vector<float>> BlockIndex::toMask() const{
+    vector<vector<float>> mask(seq_len, vector<float>(seq_len, -numeric_limits<float>::infinity()));
+    for(int qb = 0 ; qb < num_blocks ; ++qb){
+        for(int p = row_ptr[qb] ; p < row_ptr[qb + 1] ; ++p){
+            int kb = col_idx[p];
+            for(int i = qb * block_size ; i < min(seq_len, (qb + 1) * block_size) ; ++i){
+                for(int j = kb * block_size ; j < min(seq_len, (kb + 1) * block_size) ; ++j){
+                    if(causal && j > i){ continue; }
+                    mask[i][j] = 0.0f;
+                }
+            }
+        }
+    }
+    return mask;
+}
+
+void BlockSparseAttention::attend(const vector<vector<float>> &Q, const vector<vector<float>> &K,
+                                  const vector<vector<float>> &V, const BlockIndex &index, float scale, const HeadView &out){
+    int d_k = Q[0].size();
+    int d_v = V[0].size();
+    int bs = index.block_size;
+    if(out.width != d_v || index.seq_len > out.rows()){
+        throw invalid_argument("attend: output does not fit the head view");
+    }
+
+    // one row of scores only ever spans the listed tiles
+    int max_row_blocks = 0;
+    for(int qb = 0 ; qb < index.num_blocks ; ++qb){
+        max_row_blocks = max(max_row_blocks, index.row_ptr[qb + 1] - index.row_ptr[qb]);
+    }
+    vector<float> scores(static_cast<size_t>(max_row_blocks) * bs);
+    vector<int> keys(scores.size());
+
+    for(int qb = 0 ; qb < index.num_blocks ; ++qb){
+        for(int i = qb * bs ; i < min(index.seq_len, (qb + 1) * bs) ; ++i){
+            int n = 0;
+            float max_val = -1e9;
+            for(int p = index.row_ptr[qb] ; p < index.row_ptr[qb + 1] ; ++p){
+                int kb = index.col_idx[p];
+                for(int j = kb * bs ; j < min(index.seq_len, (kb + 1) * bs) ; ++j){
+                    if(index.causal && j > i){ break; }
+                    float acc = 0.0f;
+                    for(int c = 0 ; c < d_k ; ++c){
+                        acc += (Q[i][c] * K[j][c]);
+                    }
+                    keys[n] = j;
+                    scores[n] = acc * scale;
+                    max_val = max(max_val, scores[n]);
+                    ++n;
+                }
+            }
+
+            float sum = 0.0f;
+            for(int t = 0 ; t < n ; ++t){
+                scores[t] = exp(scores[t] - max_val);
+                sum += scores[t];
+            }
+
+            for(int c = 0 ; c < d_v ; ++c){
+                out(i, c) = 0.0f;
+            }
+            for(int t = 0 ; t < n ; ++t){
+                float w = scores[t] / sum;
+                const auto &v = V[keys[t]];
+                for(int c = 0 ; c < d_v ; ++c){
+                    out(i, c) += (w * v[c]);
+                }
+            }
+        }
+    }
+}
+
+vector<vector<float>> BlockSparseAttention::attendDense(const vector<vector<float>> &Q, const vector<vector<float>> &K,
+                                                        const vector<vector<float>> &V, const vector<vector<float>> &mask, float scale){
+    auto scores = AttentionCommon::matmul(Q, AttentionCommon::transpose(K));
+    for(size_t i = 0 ; i < scores.size() ; ++i){
+        for(size_t j = 0 ; j < scores[i].size() ; ++j){
+            scores[i][j] = (scores[i][j] * scale) + mask[i][j];
+        }
+    }
+    auto attention_weights = AttentionCommon::softmax(scores);
+    return AttentionCommon::matmul(attention_weights, V);
+}
@@ -0,0 +1,60 @@
+# ifndef BLOCK_SPARSE_HPP
+# define BLOCK_SPARSE_HPP
+
+# include "attention_common.hpp"
+# include <vector>
+# include <utility>
+
+/* Which (query block, key block) tiles of the score matrix are computed.
+
+   The sequence is cut into blocks of block_size tokens (the last one may be short) and
+   the pattern is the union of :
+     - local  : key blocks within +/- local_blocks of the query block (0 => the diagonal only,
+                -1 => no local band, e.g. a purely strided or global layout)
+     - global : the blocks holding global_tokens attend to, and are attended by, every block
+     - stride : key blocks whose distance to the query block is a multiple of stride
+   A non-empty 'blocks' list is taken verbatim instead. 'causal' also masks keys after
+   the query token inside the kept tiles. */
+struct BlockSparsePattern{
+    int block_size;
+    int local_blocks;       // < 0 disables the local band
+    std::vector<int> global_tokens;
+    int stride;
+    bool causal;
+    std::vector<std::pair<int, int>> blocks;
+
+    explicit BlockSparsePattern(int block_size = 16)
+    : block_size(block_size), local_blocks(0), stride(0), causal(false){}
+};
+
+// compact (CSR) list of the key blocks each query block attends to
+struct BlockIndex{
+    int block_size;
+    int seq_len;
+    int num_blocks;
+    bool causal;
+    std::vector<int> row_ptr;     // [num_blocks + 1]
+    std::vector<int> col_idx;     // key blocks, sorted within each query block
+
+    static BlockIndex build(const BlockSparsePattern &pattern, int seq_len);
+
+    int nnzBlocks() const;
+    long long nnzEntries() const; // (query, key) pairs actually scored, causal mask included
+    float density() const;        // fraction of the dense score tiles that are computed
+
+    // the equivalent dense additive mask [seq_len x seq_len] (0 => kept, -inf => dropped)
+    std::vector<std::vector<float>> toMask() const;
+};
+
+class BlockSparseAttention{
+    public:
+        // softmax(Q K^T * scale) V over the listed blocks only, written into a head slice
+        static void attend(const std::vector<std::vector<float>> &Q, const std::vector<std::vector<float>> &K,
+                           const std::vector<std::vector<float>> &V, const BlockIndex &index, float scale, const HeadView &out);
+
+        // dense reference : full scores + additive mask, then the usual softmax and AV
+        static std::vector<std::vector<float>> attendDense(const std::vector<std::vector<float>> &Q, const std::vector<std::vector<float>> &K,
+                                                           const std::vector<std::vector<float>> &V, const std::vector<std::vector<float>> &mask, float scale);
+};
+
+# endif
@@ -6,11 +6,17 @@ g++ -std=c++14 -c attention_common.cpp 2>&1 | findstr /C:"error"
 g++ -std=c++14 -c mha.cpp 2>&1 | findstr /C:"error"
 g++ -std=c++14 -c mqa.cpp 2>&1 | findstr /C:"error"
 g++ -std=c++14 -c gqa.cpp 2>&1 | findstr /C:"error"
+g++ -std=c++14 -c attention_trace.cpp 2>&1 | findstr /C:"error"
+g++ -std=c++14 -c reduced_precision.cpp 2>&1 | findstr /C:"error"
+g++ -std=c++14 -c embedding_stream.cpp 2>&1 | findstr /C:"error"
+g++ -std=c++14 -c kv_cache.cpp 2>&1 | findstr /C:"error"
+g++ -std=c++14 -c block_sparse.cpp 2>&1 | findstr /C:"error"
+g++ -std=c++14 -c tensor_parallel.cpp 2>&1 | findstr /C:"error"
 
 echo.
 
 echo Step 2 : Linking all compiled files...
-g++ -std=c++14 -o final.exe main.o attention_common.o mha.o mqa.o gqa.o -Wl,--verbose 2>&1
+g++ -std=c++14 -o final.exe main.o attention_common.o mha.o mqa.o gqa.o attention_trace.o reduced_precision.o embedding_stream.o kv_cache.o block_sparse.o tensor_parallel.o -Wl,--verbose 2>&1
 
 echo.
 
@@ -0,0 +1,142 @@
+# include "embedding_stream.hpp"
+
+# include <algorithm>
+# include <fstream>
+# include <stdexcept>
+
+# ifndef _WIN32
+# include <fcntl.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <unistd.h>
+# endif
+
+using namespace std;
+
+/*LOGIC FOR:
+
+1] MatrixEmbeddingSource : chunks of an in-memory matrix
+2] MappedEmbeddingFile   : chunks of a raw fp32 file (mmap + page release, or ifstream)
+3] MappedEmbeddingFile::write
+
+*/
+
+MatrixEmbeddingSource::MatrixEmbeddingSource(const vector<vector<float>> &M)
+: M(M), position(0){}
+
+int MatrixEmbeddingSource::dim() const{
+    return M.empty() ? 0 : M[0].size();
+}
+
+int MatrixEmbeddingSource::next(int max_rows, vector<vector<float>> &chunk){
+    int rows = min(max_rows, static_cast<int>(M.size()) - position);
+    chunk.assign(M.begin() + position, M.begin() + position + rows);
+    position += rows;
+    return rows;
+}
+
+MappedEmbeddingFile::MappedEmbeddingFile(const string &path, int dim)
+: embedding_dim(dim), total_rows(0), position(0), fd(-1), mapped(nullptr), mapped_bytes(0), released_bytes(0), stream(nullptr){
+    if(dim <= 0){
+        throw invalid_argument("embedding dimension must be positive");
+    }
+    size_t row_bytes = static_cast<size_t>(dim) * sizeof(float);
+
+# ifndef _WIN32
+    fd = open(path.c_str(), O_RDONLY);
+    if(fd < 0){
+        throw runtime_error("cannot open embedding file " + path);
+    }
+    struct stat info;
+    if(fstat(fd, &info) != 0 || (static_cast<size_t>(info.st_size) % row_bytes) != 0){
+        close(fd);
+        throw runtime_error("embedding file size is not a multiple of the row size: " + path);
+    }
+    mapped_bytes = info.st_size;
+    total_rows = mapped_bytes / row_bytes;
+
+    if(mapped_bytes > 0){
+        void *addr = mmap(nullptr, mapped_bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(addr == MAP_FAILED){
+            close(fd);
+            throw runtime_error("cannot map embedding file " + path);
+        }
+        madvise(addr, mapped_bytes, MADV_SEQUENTIAL);
+        mapped = static_cast<const float*>(addr);
+    }
+# else
+    ifstream *file = new ifstream(path, ios::binary | ios::ate);
+    if(!(*file)){
+        delete file;
+        throw runtime_error("cannot open embedding file " + path);
+    }
+    size_t file_bytes = file->tellg();
+    if((file_bytes % row_bytes) != 0){
+        delete file;
+        throw runtime_error("embedding file size is not a multiple of the row size: " + path);
+    }
+    file->seekg(0);
+    total_rows = file_bytes / row_bytes;
+    stream = file;
+# endif
+}
+
+MappedEmbeddingFile::~MappedEmbeddingFile(){
+# ifndef _WIN32
+    if(mapped){
+        munmap(const_cast<float*>(mapped), mapped_bytes);
+    }
+    if(fd >= 0){
+        close(fd);
+    }
+# else
+    delete static_cast<ifstream*>(stream);
+# endif
+}
+
+int MappedEmbeddingFile::dim() const{
+    return embedding_dim;
+}
+
+long long MappedEmbeddingFile::rows() const{
+    return total_rows;
+}
+
+int MappedEmbeddingFile::next(int max_rows, vector<vector<float>> &chunk){
+    int rows = static_cast<int>(min<long long>(max_rows, total_rows - position));
+    chunk.resize(rows);
+
+# ifndef _WIN32
+    const float *src = mapped + position * embedding_dim;
+    for(int i = 0 ; i < rows ; ++i){
+        chunk[i].assign(src + static_cast<size_t>(i) * embedding_dim, src + static_cast<size_t>(i + 1) * embedding_dim);
+    }
+    position += rows;
+
+    // hand the consumed whole pages back so the mapping never grows resident
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t consumed = ((position * embedding_dim * sizeof(float)) / page) * page;
+    if(consumed > released_bytes){
+        madvise(reinterpret_cast<char*>(const_cast<float*>(mapped)) + released_bytes, consumed - released_bytes, MADV_DONTNEED);
+        released_bytes = consumed;
+    }
+# else
+    ifstream &file = *static_cast<ifstream*>(stream);
+    for(int i = 0 ; i < rows ; ++i){
+        chunk[i].resize(embedding_dim);
+        file.read(reinterpret_cast<char*>(chunk[i].data()), embedding_dim * sizeof(float));
+    }
+    position += rows;
+# endif
+    return rows;
+}
+
+void MappedEmbeddingFile::write(const string &path, const vector<vector<float>> &M){
+    ofstream file(path, ios::binary);
+    if(!file){
+        throw runtime_error("cannot create embedding file " + path);
+    }
+    for(const auto &row : M){
+        file.write(reinterpret_cast<const char*>(row.data()), row.size() * sizeof(float));
+    }
+}
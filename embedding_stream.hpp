@@ -0,0 +1,64 @@
+# ifndef EMBEDDING_STREAM_HPP
+# define EMBEDDING_STREAM_HPP
+
+# include <string>
+# include <vector>
+# include <cstddef>
+
+// Sequential reader of [seq, d_model] embeddings, handed out a chunk at a time.
+class EmbeddingSource{
+    public:
+        virtual ~EmbeddingSource(){}
+
+        virtual int dim() const = 0;
+
+        // fills 'chunk' with up to max_rows rows, returns the row count (0 once exhausted)
+        virtual int next(int max_rows, std::vector<std::vector<float>> &chunk) = 0;
+};
+
+// chunks of a matrix that is already in memory
+class MatrixEmbeddingSource : public EmbeddingSource{
+    public:
+        explicit MatrixEmbeddingSource(const std::vector<std::vector<float>> &M);
+
+        int dim() const override;
+        int next(int max_rows, std::vector<std::vector<float>> &chunk) override;
+
+    private:
+        const std::vector<std::vector<float>> &M;
+        int position;
+};
+
+/* Raw row-major fp32 file ([seq, dim], native byte order).
+
+   Memory-mapped on POSIX : pages that have been consumed are released again, so
+   resident memory stays at about one chunk whatever the file size. Other platforms
+   read through a buffered stream. */
+class MappedEmbeddingFile : public EmbeddingSource{
+    public:
+        MappedEmbeddingFile(const std::string &path, int dim);
+        ~MappedEmbeddingFile();
+
+        MappedEmbeddingFile(const MappedEmbeddingFile&) = delete;
+        MappedEmbeddingFile &operator=(const MappedEmbeddingFile&) = delete;
+
+        int dim() const override;
+        int next(int max_rows, std::vector<std::vector<float>> &chunk) override;
+
+        long long rows() const;
+
+        static void write(const std::string &path, const std::vector<std::vector<float>> &M);
+
+    private:
+        int embedding_dim;
+        long long total_rows;
+        long long position;
+
+        int fd;
+        const float *mapped;
+        size_t mapped_bytes;
+        size_t released_bytes;       // prefix of the mapping already handed back to the OS
+        void *stream;                // std::ifstream when mmap is not available
+};
+
+# endif
@@ -1,5 +1,7 @@
 # include "gqa.hpp"
 # include "attention_common.hpp"
+# include "attention_trace.hpp"
+# include "kv_cache.hpp"
 
 # include <vector>
 # include <random>
@@ -17,13 +19,13 @@ GroupedQueryAttention::GroupedQueryAttention(int num_heads, int num_kv_heads, in
     heads_per_group = (num_heads / num_kv_heads);
     d_k = (d_model / num_heads);
     d_v = (d_model / num_heads);
+    precision = Precision::FP32;
 
     if (d_k == 0 || d_v == 0) {
         std::cerr << "ERROR: d_k or d_v is zero. d_model=" << d_model << ", num_heads=" << num_heads << std::endl;
         throw std::invalid_argument("Head dimension cannot be zero");
     }
-    
-    std::cout << "DEBUG: heads_per_group = " << heads_per_group << ", d_k=" << d_k << ", d_v=" << d_v << std::endl;
+
     initializeWeights();
 }
 
@@ -67,24 +69,35 @@ void GroupedQueryAttention::initializeWeights(){
 }
 
 vector<vector<float>> GroupedQueryAttention::forward(const vector<vector<float>> &X){
+    if(precision != Precision::FP32){
+        return forwardReducedPrecision(X);
+    }
+    ATTN_TRACE_SCOPE("gqa", "forward", -1);
     int seq_len = X.size();
-    vector<vector<float>> output(seq_len, vector<float>(d_model, 0.0f));
-    vector<vector<vector<float>>> head_outputs(num_heads);
+    // [seq, num_heads, d_v] : every head writes its AV result into its own slice
+    vector<vector<float>> heads(seq_len, vector<float>(num_heads * d_v, 0.0f));
 
     // Pre-compute K and V matrices for each group
     vector<vector<vector<float>>> K_groups, V_groups;
     for(int kvh = 0 ; kvh < num_kv_heads ; ++kvh){
+        ATTN_TRACE_BEGIN(kv_span, "gqa", "kv_projection", kvh);
         K_groups.push_back(AttentionCommon::matmul(X, W_k[kvh]));
         V_groups.push_back(AttentionCommon::matmul(X, W_v[kvh]));
+        ATTN_TRACE_END(kv_span);
+        ATTN_TRACE_COUNT("gqa", "kv_flops", kvh, 2.0 * seq_len * d_model * (d_k + d_v));
     }
 
     for(int h = 0 ; h < num_heads ; ++h){
         int curr_group_idx = (h / heads_per_group);
 
+        ATTN_TRACE_BEGIN(q_span, "gqa", "qkv_projection", h);
         auto Q = AttentionCommon::matmul(X, W_q[h]);
+        ATTN_TRACE_END(q_span);
+        ATTN_TRACE_COUNT("gqa", "flops", h, 2.0 * seq_len * d_model * d_k);
         auto& K = K_groups[curr_group_idx];
         auto& V = V_groups[curr_group_idx];
 
+        ATTN_TRACE_BEGIN(scores_span, "gqa", "scores", h);
         auto K_t = AttentionCommon::transpose(K);
         auto scores = AttentionCommon::matmul(Q, K_t);
 
@@ -94,24 +107,26 @@ vector<vector<float>> GroupedQueryAttention::forward(const vector<vector<float>>
                 val *= scale;
             }
         }
+        ATTN_TRACE_END(scores_span);
+        ATTN_TRACE_COUNT("gqa", "flops", h, 2.0 * seq_len * seq_len * d_k);
         
         // Apply softmax
+        ATTN_TRACE_BEGIN(softmax_span, "gqa", "softmax", h);
         auto attention_weights = AttentionCommon::softmax(scores);
+        ATTN_TRACE_END(softmax_span);
         
         // Apply attention to values
-        head_outputs[h] = AttentionCommon::matmul(attention_weights, V);
-    }
-
-    for(int h = 0 ; h < num_heads ; ++h){
-        for(int i = 0 ; i < seq_len ; ++i){
-            for(int j = 0 ; j < d_v ; ++j){
-                output[i][(h * d_v) + j] = head_outputs[h][i][j];
-            }
-        }
+        ATTN_TRACE_BEGIN(av_span, "gqa", "av", h);
+        AttentionCommon::matmulInto(attention_weights, V, splitHeads(heads, h));
+        ATTN_TRACE_END(av_span);
+        ATTN_TRACE_COUNT("gqa", "flops", h, 2.0 * seq_len * seq_len * d_v);
     }
 
     // final linear projection
-    output = AttentionCommon::matmul(output, W_o);
+    ATTN_TRACE_BEGIN(out_span, "gqa", "output_projection", -1);
+    auto output = AttentionCommon::matmul(combineHeads(heads), W_o);
+    ATTN_TRACE_END(out_span);
+    ATTN_TRACE_COUNT("gqa", "flops", -1, 2.0 * seq_len * d_model * d_model);
 
     return output;
 }
@@ -126,12 +141,16 @@ void GroupedQueryAttention::printMemoryUsage(const vector<vector<float>>& X) {
         kv_cache_memory += AttentionCommon::calculateMemoryKB(K) + AttentionCommon::calculateMemoryKB(V);
     }
     
+    // K / V are held at the storage precision
+    kv_cache_memory = (kv_cache_memory * ReducedPrecision::bytesPerElement(precision)) / sizeof(float);
+
     cout << "=== Grouped Query Attention Memory Usage ===\n";
     cout << "Number of query heads: " << num_heads << "\n";
     cout << "Number of KV heads (groups): " << num_kv_heads << "\n";
     cout << "Heads per group: " << heads_per_group << "\n";
     cout << "Model dimension: " << d_model << "\n";
     cout << "Head dimension (d_k): " << d_k << "\n";
+    cout << "Storage precision: " << ReducedPrecision::name(precision) << "\n";
     cout << "KV Cache Memory: " << kv_cache_memory << " KB\n";
     cout << "Total Parameters: " << (num_heads * d_model * d_k + 2 * num_kv_heads * d_model * d_k + d_model * d_model) << "\n";
     cout << "============================================\n\n";
@@ -165,4 +184,235 @@ vector<vector<vector<float>>> GroupedQueryAttention::getAttentionWeights(const v
         all_attention_weights.push_back(attention_weights);
     }
     return all_attention_weights;
+}
+
+HeadView GroupedQueryAttention::splitHeads(vector<vector<float>> &heads, int head){
+    return HeadView{&heads, head * d_v, d_v};
+}
+
+const vector<vector<float>>& GroupedQueryAttention::combineHeads(const vector<vector<float>> &heads){
+    // heads are already laid out as concat(h1, h2, ... h(num_heads)) per row
+    return heads;
+}
+
+void GroupedQueryAttention::setPrecision(Precision precision){
+    this->precision = precision;
+    W_q_half.clear();
+    W_k_half.clear();
+    W_v_half.clear();
+    W_o_half = HalfMatrix();
+    if(precision == Precision::FP32){
+        return;
+    }
+
+    for(int h = 0 ; h < num_heads ; ++h){
+        W_q_half.push_back(ReducedPrecision::quantize(W_q[h], precision));
+    }
+    for(int kvh = 0 ; kvh < num_kv_heads ; ++kvh){
+        W_k_half.push_back(ReducedPrecision::quantize(W_k[kvh], precision));
+        W_v_half.push_back(ReducedPrecision::quantize(W_v[kvh], precision));
+    }
+
+    // only the W_o rows that the concatenated heads reach
+    W_o_half = ReducedPrecision::quantize(vector<vector<float>>(W_o.begin(), W_o.begin() + num_heads * d_v), precision);
+}
+
+Precision GroupedQueryAttention::getPrecision() const{
+    return precision;
+}
+
+vector<vector<float>> GroupedQueryAttention::forwardReducedPrecision(const vector<vector<float>> &X){
+    ATTN_TRACE_SCOPE("gqa", "forward_reduced_precision", -1);
+    // stages are traced under "gqa_half" so they stay apart from the fp32 ones
+    int seq_len = X.size();
+    auto X_half = ReducedPrecision::quantize(X, precision);
+
+    // [seq, num_heads, d_v] in 16-bit storage
+    auto heads = ReducedPrecision::createMatrix(seq_len, num_heads * d_v, precision);
+
+    // 16-bit K / V per group (the KV cache)
+    vector<HalfMatrix> K_groups, V_groups;
+    for(int kvh = 0 ; kvh < num_kv_heads ; ++kvh){
+        ATTN_TRACE_BEGIN(kv_span, "gqa_half", "kv_projection", kvh);
+        K_groups.push_back(ReducedPrecision::matmul(X_half, W_k_half[kvh]));
+        V_groups.push_back(ReducedPrecision::matmul(X_half, W_v_half[kvh]));
+        ATTN_TRACE_END(kv_span);
+        ATTN_TRACE_COUNT("gqa_half", "kv_flops", kvh, 2.0 * seq_len * d_model * (d_k + d_v));
+    }
+
+    for(int h = 0 ; h < num_heads ; ++h){
+        int curr_group_idx = (h / heads_per_group);
+        ATTN_TRACE_BEGIN(q_span, "gqa_half", "qkv_projection", h);
+        auto Q = ReducedPrecision::matmul(X_half, W_q_half[h]);
+        ATTN_TRACE_END(q_span);
+        ATTN_TRACE_COUNT("gqa_half", "flops", h, 2.0 * seq_len * d_model * d_k);
+        auto& K = K_groups[curr_group_idx];
+        auto& V = V_groups[curr_group_idx];
+
+        // scores and softmax are computed in fp32
+        ATTN_TRACE_BEGIN(scores_span, "gqa_half", "scores", h);
+        auto scores = ReducedPrecision::matmulTransposed(Q, K);
+        float scale = 1.0f / std::sqrt(static_cast<float>(d_k));
+        for (auto& row : scores) {
+            for (auto& val : row) {
+                val *= scale;
+            }
+        }
+        ATTN_TRACE_END(scores_span);
+        ATTN_TRACE_COUNT("gqa_half", "flops", h, 2.0 * seq_len * seq_len * d_k);
+
+        ATTN_TRACE_BEGIN(softmax_span, "gqa_half", "softmax", h);
+        auto attention_weights = AttentionCommon::softmax(scores);
+        ATTN_TRACE_END(softmax_span);
+
+        ATTN_TRACE_BEGIN(av_span, "gqa_half", "av", h);
+        ReducedPrecision::matmulInto(attention_weights, V, heads, h * d_v);
+        ATTN_TRACE_END(av_span);
+        ATTN_TRACE_COUNT("gqa_half", "flops", h, 2.0 * seq_len * seq_len * d_v);
+    }
+
+    ATTN_TRACE_BEGIN(out_span, "gqa_half", "output_projection", -1);
+    auto output = ReducedPrecision::matmulFloat(heads, W_o_half);
+    ATTN_TRACE_END(out_span);
+    ATTN_TRACE_COUNT("gqa_half", "flops", -1, 2.0 * seq_len * d_model * d_model);
+    return output;
+}
+
+void GroupedQueryAttention::prefillStreaming(EmbeddingSource &source, int chunk_size, int window,
+                          const function<void(long long, const vector<vector<float>>&)> &sink){
+    if(source.dim() != d_model){
+        throw invalid_argument("embedding source width does not match d_model");
+    }
+    RollingKVCache cache(num_kv_heads, d_k, d_v, window, chunk_size, precision);
+    float scale = 1.0f / std::sqrt(static_cast<float>(d_k));
+
+    vector<vector<float>> X;
+    long long start = 0;
+    while(int rows = source.next(chunk_size, X)){
+        ATTN_TRACE_SCOPE("gqa", "prefill_chunk", -1);
+
+        if(precision != Precision::FP32){
+            // same storage as forwardReducedPrecision : 16-bit X, K/V and heads, fp32 scores
+            auto X_half = ReducedPrecision::quantize(X, precision);
+            vector<HalfMatrix> K_half, V_half;
+            for(int kvh = 0 ; kvh < num_kv_heads ; ++kvh){
+                K_half.push_back(ReducedPrecision::matmul(X_half, W_k_half[kvh]));
+                V_half.push_back(ReducedPrecision::matmul(X_half, W_v_half[kvh]));
+            }
+            cache.append(K_half, V_half);
+
+            vector<vector<float>> heads(rows, vector<float>(num_heads * d_v, 0.0f));
+            for(int h = 0 ; h < num_heads ; ++h){
+                auto Q = ReducedPrecision::dequantize(ReducedPrecision::matmul(X_half, W_q_half[h]));
+                cache.attend(h / heads_per_group, Q, scale, splitHeads(heads, h));
+            }
+
+            sink(start, ReducedPrecision::matmulFloat(ReducedPrecision::quantize(heads, precision), W_o_half));
+        }else{
+            vector<vector<vector<float>>> K_chunk, V_chunk;
+            for(int kvh = 0 ; kvh < num_kv_heads ; ++kvh){
+                K_chunk.push_back(AttentionCommon::matmul(X, W_k[kvh]));
+                V_chunk.push_back(AttentionCommon::matmul(X, W_v[kvh]));
+            }
+            cache.append(K_chunk, V_chunk);
+
+            vector<vector<float>> heads(rows, vector<float>(num_heads * d_v, 0.0f));
+            for(int h = 0 ; h < num_heads ; ++h){
+                auto Q = AttentionCommon::matmul(X, W_q[h]);
+                cache.attend(h / heads_per_group, Q, scale, splitHeads(heads, h));
+            }
+
+            sink(start, AttentionCommon::matmul(combineHeads(heads), W_o));
+        }
+        start += rows;
+    }
+}
+
+vector<vector<float>> GroupedQueryAttention::forwardBlockSparse(const vector<vector<float>> &X, const BlockSparsePattern &pattern){
+    ATTN_TRACE_SCOPE("gqa", "forward_block_sparse", -1);
+    int seq_len = X.size();
+
+    // the block index depends only on the pattern and length : built once for all heads
+    BlockIndex index = BlockIndex::build(pattern, seq_len);
+    float scale = 1.0f / std::sqrt(static_cast<float>(d_k));
+
+    // with bf16 / fp16 selected the projections and heads are 16-bit, as in forwardReducedPrecision;
+    // the tiles are scored in fp32 either way
+    bool fp32 = (precision == Precision::FP32);
+    HalfMatrix X_half;
+    if(!fp32){
+        X_half = ReducedPrecision::quantize(X, precision);
+    }
+
+    vector<vector<float>> heads(seq_len, vector<float>(num_heads * d_v, 0.0f));
+    vector<vector<vector<float>>> K_groups, V_groups;
+    for(int kvh = 0 ; kvh < num_kv_heads ; ++kvh){
+        ATTN_TRACE_BEGIN(kv_span, "gqa_sparse", "kv_projection", kvh);
+        auto K = fp32 ? AttentionCommon::matmul(X, W_k[kvh])
+                      : ReducedPrecision::dequantize(ReducedPrecision::matmul(X_half, W_k_half[kvh]));
+        auto V = fp32 ? AttentionCommon::matmul(X, W_v[kvh])
+                      : ReducedPrecision::dequantize(ReducedPrecision::matmul(X_half, W_v_half[kvh]));
+        K_groups.push_back(std::move(K));
+        V_groups.push_back(std::move(V));
+        ATTN_TRACE_END(kv_span);
+        ATTN_TRACE_COUNT("gqa_sparse", "kv_flops", kvh, 2.0 * seq_len * d_model * (d_k + d_v));
+    }
+
+    for(int h = 0 ; h < num_heads ; ++h){
+        int curr_group_idx = (h / heads_per_group);
+        ATTN_TRACE_BEGIN(q_span, "gqa_sparse", "qkv_projection", h);
+        auto Q = fp32 ? AttentionCommon::matmul(X, W_q[h])
+                      : ReducedPrecision::dequantize(ReducedPrecision::matmul(X_half, W_q_half[h]));
+        ATTN_TRACE_END(q_span);
+        ATTN_TRACE_COUNT("gqa_sparse", "flops", h, 2.0 * seq_len * d_model * d_k);
+
+        ATTN_TRACE_BEGIN(attend_span, "gqa_sparse", "scores_softmax_av", h);
+        BlockSparseAttention::attend(Q, K_groups[curr_group_idx], V_groups[curr_group_idx], index, scale, splitHeads(heads, h));
+        ATTN_TRACE_END(attend_span);
+        ATTN_TRACE_COUNT("gqa_sparse", "flops", h, 2.0 * index.nnzEntries() * (d_k + d_v));
+    }
+
+    ATTN_TRACE_BEGIN(out_span, "gqa_sparse", "output_projection", -1);
+    auto output = fp32 ? AttentionCommon::matmul(combineHeads(heads), W_o)
+                       : ReducedPrecision::matmulFloat(ReducedPrecision::quantize(heads, precision), W_o_half);
+    ATTN_TRACE_END(out_span);
+    ATTN_TRACE_COUNT("gqa_sparse", "flops", -1, 2.0 * seq_len * d_model * d_model);
+    return output;
+}
+
+AttentionShard GroupedQueryAttention::makeShard(int rank, int world) const{
+    if(world <= 0 || rank < 0 || rank >= world){
+        throw invalid_argument("shard rank must be in [0, world) with world > 0");
+    }
+    if((num_kv_heads % world) != 0){
+        throw invalid_argument("num_kv_heads must be divisible by the number of shards");
+    }
+    // whole groups per shard, so every local query head finds its K/V locally
+    int local_kv_heads = (num_kv_heads / world);
+    int first_kv_head = (rank * local_kv_heads);
+    int local_heads = (local_kv_heads * heads_per_group);
+    int first_head = (first_kv_head * heads_per_group);
+
+    AttentionShard shard;
+    shard.d_model = d_model;
+    shard.num_heads = local_heads;
+    shard.num_kv_heads = local_kv_heads;
+    shard.d_k = d_k;
+    shard.d_v = d_v;
+    shard.W_q.assign(W_q.begin() + first_head, W_q.begin() + first_head + local_heads);
+    shard.W_k.assign(W_k.begin() + first_kv_head, W_k.begin() + first_kv_head + local_kv_heads);
+    shard.W_v.assign(W_v.begin() + first_kv_head, W_v.begin() + first_kv_head + local_kv_heads);
+
+    // rows of W_o that multiply this shard's slice of the concatenated heads
+    shard.W_o.assign(W_o.begin() + first_head * d_v, W_o.begin() + (first_head + local_heads) * d_v);
+
+    // the 16-bit copies, so the shards reproduce forward() in the selected precision
+    shard.precision = precision;
+    if(precision != Precision::FP32){
+        shard.W_q_half.assign(W_q_half.begin() + first_head, W_q_half.begin() + first_head + local_heads);
+        shard.W_k_half.assign(W_k_half.begin() + first_kv_head, W_k_half.begin() + first_kv_head + local_kv_heads);
+        shard.W_v_half.assign(W_v_half.begin() + first_kv_head, W_v_half.begin() + first_kv_head + local_kv_heads);
+        shard.W_o_half = ReducedPrecision::quantize(shard.W_o, precision);
+    }
+    return shard;
 }
\ No newline at end of file
@@ -2,7 +2,12 @@
 # define GQA_HPP
 
 #include "attention_common.hpp"
+#include "reduced_precision.hpp"
+#include "embedding_stream.hpp"
+#include "block_sparse.hpp"
+#include "tensor_parallel.hpp"
 #include <vector>
+#include <functional>
 
 class GroupedQueryAttention{
     private:
@@ -24,12 +29,33 @@ class GroupedQueryAttention{
         std::vector<std::vector<std::vector<float>>> W_k;     // Fewer K projections (groups)
         std::vector<std::vector<std::vector<float>>> W_v;     // Fewer V projections (groups)
         std::vector<std::vector<float>> W_o;                  // Output projection
+
+        // 16-bit copies of the weights, built by setPrecision() (the fp32 weights stay as reference)
+        Precision precision;
+        std::vector<HalfMatrix> W_q_half;
+        std::vector<HalfMatrix> W_k_half;
+        std::vector<HalfMatrix> W_v_half;
+        HalfMatrix W_o_half;
     
     public:
         GroupedQueryAttention(int num_heads, int num_kv_heads, int d_model);
 
         std::vector<std::vector<float>> forward(const std::vector<std::vector<float>> &X);
 
+        // block-sparse variant of forward() : only the pattern's tiles are scored, in the storage precision of setPrecision()
+        std::vector<std::vector<float>> forwardBlockSparse(const std::vector<std::vector<float>> &X, const BlockSparsePattern &pattern);
+
+        // storage precision of weights, activations and K/V (accumulation always fp32)
+        void setPrecision(Precision precision);
+        Precision getPrecision() const;
+
+        // chunked causal prefill, one rolling K/V cache entry per group ('window' tokens each)
+        void prefillStreaming(EmbeddingSource &source, int chunk_size, int window,
+                              const std::function<void(long long, const std::vector<std::vector<float>>&)> &sink);
+
+        // whole KV groups per shard : num_kv_heads % world == 0
+        AttentionShard makeShard(int rank, int world) const;
+
         // memory usage analysis
         void printMemoryUsage(const std::vector<std::vector<float>> &X);
 
@@ -39,9 +65,14 @@ class GroupedQueryAttention{
     private:
         void initializeWeights();
 
-        std::vector<std::vector<float>> splitHeads(const std::vector<std::vector<float>> &X, int head_size);
+        // fp32 forward() with 16-bit storage (see setPrecision)
+        std::vector<std::vector<float>> forwardReducedPrecision(const std::vector<std::vector<float>> &X);
+
+        // head h of a [seq, num_heads * d_v] buffer, as a view (no copy)
+        HeadView splitHeads(std::vector<std::vector<float>> &heads, int head);
 
-        std::vector<std::vector<float>> combineHeads(const std::vector<std::vector<float>>& X);
+        // merged heads feed W_o directly : the buffer already is the concatenation
+        const std::vector<std::vector<float>>& combineHeads(const std::vector<std::vector<float>> &heads);
 };
 
 # endif
\ No newline at end of file
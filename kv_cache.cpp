@@ -0,0 +1,136 @@
+# include "kv_cache.hpp"
+# include "attention_trace.hpp"
+
+# include <algorithm>
+# include <cmath>
+# include <stdexcept>
+
+using namespace std;
+
+RollingKVCache::RollingKVCache(int num_kv_heads, int d_k, int d_v, int window, int chunk_size, Precision precision)
+: num_kv_heads(num_kv_heads), d_k(d_k), d_v(d_v), window(window), total(0), precision(precision),
+  widened_head(-1), widened_total(-1){
+    if(window <= 0 || chunk_size <= 0){
+        throw invalid_argument("window and chunk_size must be positive");
+    }
+    capacity = window + chunk_size - 1;
+
+    if(precision == Precision::FP32){
+        K.assign(num_kv_heads, vector<vector<float>>(capacity, vector<float>(d_k, 0.0f)));
+        V.assign(num_kv_heads, vector<vector<float>>(capacity, vector<float>(d_v, 0.0f)));
+        ATTN_TRACE_ALLOC(memoryBytes());
+    }else{
+        // createMatrix records its own allocation
+        for(int kvh = 0 ; kvh < num_kv_heads ; ++kvh){
+            K_half.push_back(ReducedPrecision::createMatrix(capacity, d_k, precision));
+            V_half.push_back(ReducedPrecision::createMatrix(capacity, d_v, precision));
+        }
+        K_wide.assign(capacity, vector<float>(d_k, 0.0f));
+        V_wide.assign(capacity, vector<float>(d_v, 0.0f));
+        ATTN_TRACE_ALLOC(static_cast<size_t>(capacity) * (d_k + d_v) * sizeof(float));
+    }
+}
+
+void RollingKVCache::append(const vector<vector<vector<float>>> &K_chunk, const vector<vector<vector<float>>> &V_chunk){
+    int rows = K_chunk[0].size();
+    if(rows > capacity - window + 1){
+        throw invalid_argument("chunk is larger than the cache was sized for");
+    }
+
+    for(int kvh = 0 ; kvh < num_kv_heads ; ++kvh){
+        for(int i = 0 ; i < rows ; ++i){
+            int slot = static_cast<int>((total + i) % capacity);
+            if(precision == Precision::FP32){
+                copy(K_chunk[kvh][i].begin(), K_chunk[kvh][i].end(), K[kvh][slot].begin());
+                copy(V_chunk[kvh][i].begin(), V_chunk[kvh][i].end(), V[kvh][slot].begin());
+            }else{
+                ReducedPrecision::encode(K_chunk[kvh][i].data(), K_half[kvh].row(slot), d_k, precision);
+                ReducedPrecision::encode(V_chunk[kvh][i].data(), V_half[kvh].row(slot), d_v, precision);
+            }
+        }
+    }
+    total += rows;
+}
+
+void RollingKVCache::append(const vector<HalfMatrix> &K_chunk, const vector<HalfMatrix> &V_chunk){
+    int rows = K_chunk[0].rows;
+    if(precision == Precision::FP32 || K_chunk[0].precision != precision || V_chunk[0].precision != precision){
+        throw invalid_argument("16-bit chunk does not match the cache precision");
+    }
+    if(rows > capacity - window + 1){
+        throw invalid_argument("chunk is larger than the cache was sized for");
+    }
+
+    for(int kvh = 0 ; kvh < num_kv_heads ; ++kvh){
+        for(int i = 0 ; i < rows ; ++i){
+            int slot = static_cast<int>((total + i) % capacity);
+            copy(K_chunk[kvh].row(i), K_chunk[kvh].row(i) + d_k, K_half[kvh].row(slot));
+            copy(V_chunk[kvh].row(i), V_chunk[kvh].row(i) + d_v, V_half[kvh].row(slot));
+        }
+    }
+    total += rows;
+}
+
+void RollingKVCache::attend(int kv_head, const vector<vector<float>> &Q, float scale, const HeadView &out) const{
+    int rows = Q.size();
+    long long start = total - rows;
+    if(out.width != d_v || rows > out.rows()){
+        throw invalid_argument("attend: output does not fit the head view");
+    }
+
+    // 16-bit slots : widened once per kv head and chunk, the query heads of a group reuse them
+    if(precision != Precision::FP32 && (widened_head != kv_head || widened_total != total)){
+        for(long long p = max(0LL, total - capacity) ; p < total ; ++p){
+            int slot = static_cast<int>(p % capacity);
+            ReducedPrecision::decode(K_half[kv_head].row(slot), K_wide[slot].data(), d_k, precision);
+            ReducedPrecision::decode(V_half[kv_head].row(slot), V_wide[slot].data(), d_v, precision);
+        }
+        widened_head = kv_head;
+        widened_total = total;
+    }
+    const auto &K_h = (precision == Precision::FP32) ? K[kv_head] : K_wide;
+    const auto &V_h = (precision == Precision::FP32) ? V[kv_head] : V_wide;
+
+    vector<float> scores(window);
+    for(int i = 0 ; i < rows ; ++i){
+        long long p = start + i;
+        long long first = max(0LL, p - window + 1);
+        int n = static_cast<int>(p - first + 1);
+
+        // scores over the visible keys, softmax in place
+        float max_val = -1e9;
+        for(int t = 0 ; t < n ; ++t){
+            const auto &k = K_h[(first + t) % capacity];
+            float acc = 0.0f;
+            for(int j = 0 ; j < d_k ; ++j){
+                acc += (Q[i][j] * k[j]);
+            }
+            scores[t] = acc * scale;
+            max_val = max(max_val, scores[t]);
+        }
+        float sum = 0.0f;
+        for(int t = 0 ; t < n ; ++t){
+            scores[t] = exp(scores[t] - max_val);
+            sum += scores[t];
+        }
+
+        for(int j = 0 ; j < d_v ; ++j){
+            out(i, j) = 0.0f;
+        }
+        for(int t = 0 ; t < n ; ++t){
+            const auto &v = V_h[(first + t) % capacity];
+            float w = scores[t] / sum;
+            for(int j = 0 ; j < d_v ; ++j){
+                out(i, j) += (w * v[j]);
+            }
+        }
+    }
+}
+
+long long RollingKVCache::length() const{
+    return total;
+}
+
+size_t RollingKVCache::memoryBytes() const{
+    return static_cast<size_t>(num_kv_heads) * capacity * (d_k + d_v) * ReducedPrecision::bytesPerElement(precision);
+}
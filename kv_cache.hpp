@@ -0,0 +1,59 @@
+# ifndef KV_CACHE_HPP
+# define KV_CACHE_HPP
+
+# include "attention_common.hpp"
+# include "reduced_precision.hpp"
+# include <vector>
+# include <cstddef>
+
+/* Rolling (ring buffer) K/V cache for causal sliding-window attention, as in Mistral.
+
+   A query at position p sees keys [p - window + 1, p]. The buffer keeps
+   window + chunk_size - 1 slots per kv head : enough for every query of the newest
+   chunk, and never more, so memory does not depend on how many tokens were streamed.
+   With window >= total length this is plain causal attention.
+
+   With a bf16 / fp16 precision the slots hold 16-bit K/V (half the bytes). One kv head at a
+   time is widened into an fp32 scratch, once per chunk : call attend() for all query heads
+   of a kv head back to back. Scores and softmax stay in fp32. */
+class RollingKVCache{
+    public:
+        RollingKVCache(int num_kv_heads, int d_k, int d_v, int window, int chunk_size, Precision precision = Precision::FP32);
+
+        // K_chunk[kvh] / V_chunk[kvh] : [rows, d_k] / [rows, d_v] for the next 'rows' positions
+        void append(const std::vector<std::vector<std::vector<float>>> &K_chunk, const std::vector<std::vector<std::vector<float>>> &V_chunk);
+
+        // same, already in the cache's 16-bit precision (copied without re-rounding)
+        void append(const std::vector<HalfMatrix> &K_chunk, const std::vector<HalfMatrix> &V_chunk);
+
+        // causal windowed attention of the most recently appended rows (Q : [rows, d_k]) into out
+        void attend(int kv_head, const std::vector<std::vector<float>> &Q, float scale, const HeadView &out) const;
+
+        long long length() const;
+        size_t memoryBytes() const;
+
+    private:
+        int num_kv_heads;
+        int d_k;
+        int d_v;
+        int window;
+        int capacity;
+        long long total;        // positions appended so far
+        Precision precision;
+
+        // [kv_head][slot][d] , slot = position % capacity (fp32 only)
+        std::vector<std::vector<std::vector<float>>> K;
+        std::vector<std::vector<std::vector<float>>> V;
+
+        // [kv_head] -> [capacity x d] , same slots (bf16 / fp16 only)
+        std::vector<HalfMatrix> K_half;
+        std::vector<HalfMatrix> V_half;
+
+        // fp32 copy of one kv head's slots, valid while (widened_head, widened_total) match
+        mutable std::vector<std::vector<float>> K_wide;
+        mutable std::vector<std::vector<float>> V_wide;
+        mutable int widened_head;
+        mutable long long widened_total;
+};
+
+# endif
@@ -5,13 +5,13 @@ where g++
 g++ --version
 
 echo Approach 1: Link all .cpp files together
-g++ -std=c++14 -o test1.exe main.cpp attention_common.cpp mha.cpp mqa.cpp gqa.cpp 2>&1
+g++ -std=c++14 -o test1.exe main.cpp attention_common.cpp mha.cpp mqa.cpp gqa.cpp attention_trace.cpp reduced_precision.cpp embedding_stream.cpp kv_cache.cpp block_sparse.cpp tensor_parallel.cpp 2>&1
 
 if %errorlevel% neq 0 (
     echo.
     echo Approach 1 failed, trying Approach 2...
     echo Approach 2: Link with verbose output
-    g++ -std=c++14 -o test2.exe main.cpp attention_common.cpp mha.cpp mqa.cpp gqa.cpp -Wl,--verbose 2>&1 | findstr /C:"error:" /C:"undefined"
+    g++ -std=c++14 -o test2.exe main.cpp attention_common.cpp mha.cpp mqa.cpp gqa.cpp attention_trace.cpp reduced_precision.cpp embedding_stream.cpp kv_cache.cpp block_sparse.cpp tensor_parallel.cpp -Wl,--verbose 2>&1 | findstr /C:"error:" /C:"undefined"
 )
 
 if exist test1.exe (
@@ -1,12 +1,155 @@
 #include "mha.hpp"
 #include "mqa.hpp"
 #include "gqa.hpp"
+#include "attention_trace.hpp"
 
 #include <iostream>
 #include <vector>
+#include <cstdio>
+#include <cmath>
+#include <limits>
+#include <functional>
+#include <memory>
 
 using namespace std;
 
+// accuracy of the 16-bit storage modes against the fp32 forward()
+template <typename Attention>
+void reportPrecisionDeltas(Attention &attention, const vector<vector<float>> &X, const string &label){
+    auto reference = attention.forward(X);
+    float reference_max = AttentionCommon::maxAbsDiff(reference, AttentionCommon::createMatrix(reference.size(), reference[0].size()));
+
+    for(Precision precision : {Precision::BF16, Precision::FP16}){
+        attention.setPrecision(precision);
+        auto reduced = attention.forward(X);
+        float delta = AttentionCommon::maxAbsDiff(reference, reduced);
+        cout << label << " " << ReducedPrecision::name(precision) << ": max |delta| = " << delta
+             << " (relative " << (delta / reference_max) << ")\n";
+    }
+    attention.setPrecision(Precision::FP32);
+}
+
+// dense causal sliding-window attention : full scores + a band mask, built from the unsplit weights
+template <typename Attention>
+vector<vector<float>> slidingWindowReference(const Attention &attention, const vector<vector<float>> &X, int window){
+    AttentionShard full = attention.makeShard(0, 1);
+    int seq_len = X.size();
+    int heads_per_group = full.num_heads / full.num_kv_heads;
+    float scale = 1.0f / std::sqrt(static_cast<float>(full.d_k));
+
+    vector<vector<float>> mask(seq_len, vector<float>(seq_len, -numeric_limits<float>::infinity()));
+    for(int i = 0 ; i < seq_len ; ++i){
+        for(int j = max(0, i - window + 1) ; j <= i ; ++j){
+            mask[i][j] = 0.0f;
+        }
+    }
+
+    vector<vector<float>> heads(seq_len, vector<float>(full.num_heads * full.d_v, 0.0f));
+    for(int h = 0 ; h < full.num_heads ; ++h){
+        auto Q = AttentionCommon::matmul(X, full.W_q[h]);
+        auto K = AttentionCommon::matmul(X, full.W_k[h / heads_per_group]);
+        auto V = AttentionCommon::matmul(X, full.W_v[h / heads_per_group]);
+        auto head = BlockSparseAttention::attendDense(Q, K, V, mask, scale);
+        for(int i = 0 ; i < seq_len ; ++i){
+            copy(head[i].begin(), head[i].end(), heads[i].begin() + h * full.d_v);
+        }
+    }
+    return AttentionCommon::matmul(heads, full.W_o);
+}
+
+// chunked prefill from a memory-mapped file must agree with a single causal chunk,
+// a window shorter than the input with the dense sliding-window reference,
+// and the bf16 / fp16 stream with the same precision's forward() on the last token
+template <typename Attention>
+void reportStreamingDeltas(Attention &attention, const vector<vector<float>> &X, const string &path, const string &label){
+    int seq_len = X.size();
+    vector<vector<float>> one_shot, streamed;
+    auto collect = [](vector<vector<float>> &into){
+        return [&into](long long, const vector<vector<float>> &out){
+            into.insert(into.end(), out.begin(), out.end());
+        };
+    };
+
+    MatrixEmbeddingSource in_memory(X);
+    attention.prefillStreaming(in_memory, seq_len, seq_len, collect(one_shot));
+
+    MappedEmbeddingFile mapped(path, X[0].size());
+    attention.prefillStreaming(mapped, 4, seq_len, collect(streamed));
+
+    cout << label << " chunk=4 (mmap) vs one chunk: max |delta| = " << AttentionCommon::maxAbsDiff(one_shot, streamed) << "\n";
+
+    const int WINDOW = 5;
+    vector<vector<float>> windowed;
+    MatrixEmbeddingSource again(X);
+    attention.prefillStreaming(again, 4, WINDOW, collect(windowed));
+    cout << label << " chunk=4 window=" << WINDOW << " vs dense sliding window: max |delta| = "
+         << AttentionCommon::maxAbsDiff(slidingWindowReference(attention, X, WINDOW), windowed) << "\n";
+
+    // 16-bit storage : the last token sees the whole (causal) input, like the same precision's forward()
+    for(Precision precision : {Precision::BF16, Precision::FP16}){
+        attention.setPrecision(precision);
+        vector<vector<float>> reduced;
+        MatrixEmbeddingSource source(X);
+        attention.prefillStreaming(source, 4, seq_len, collect(reduced));
+        float delta = AttentionCommon::maxAbsDiff({attention.forward(X).back()}, {reduced.back()});
+        cout << label << " " << ReducedPrecision::name(precision) << " chunk=4 last token vs forward(): max |delta| = " << delta << "\n";
+    }
+    attention.setPrecision(Precision::FP32);
+}
+
+// a pattern that keeps every tile must reproduce the dense forward(), in every storage precision
+template <typename Attention>
+void reportBlockSparseDense(Attention &attention, const vector<vector<float>> &X, const string &label){
+    BlockSparsePattern all_tiles(4);
+    all_tiles.local_blocks = X.size();
+    float delta = AttentionCommon::maxAbsDiff(attention.forward(X), attention.forwardBlockSparse(X, all_tiles));
+    cout << label << " all tiles vs forward(): max |delta| = " << delta << "\n";
+
+    for(Precision precision : {Precision::BF16, Precision::FP16}){
+        attention.setPrecision(precision);
+        delta = AttentionCommon::maxAbsDiff(attention.forward(X), attention.forwardBlockSparse(X, all_tiles));
+        cout << label << " " << ReducedPrecision::name(precision) << " all tiles vs forward(): max |delta| = " << delta << "\n";
+    }
+    attention.setPrecision(Precision::FP32);
+}
+
+void reportBlockSparsePatterns(const string &text){
+    auto Q = AttentionCommon::textToEmbedding(text, 8);
+    auto K = AttentionCommon::textToEmbedding(text, 8);
+    auto V = AttentionCommon::textToEmbedding(text, 8);
+    float scale = 1.0f / sqrt(8.0f);
+
+    vector<pair<string, BlockSparsePattern>> patterns;
+    BlockSparsePattern local(4);
+    local.local_blocks = 1;
+    patterns.push_back({"local", local});
+
+    BlockSparsePattern global = local;
+    global.global_tokens = {0};
+    patterns.push_back({"local + global", global});
+
+    BlockSparsePattern strided(4);
+    strided.stride = 2;
+    patterns.push_back({"strided", strided});
+
+    BlockSparsePattern causal = global;
+    causal.causal = true;
+    patterns.push_back({"causal local + global", causal});
+
+    BlockSparsePattern layout(4);
+    layout.blocks = {{0, 0}, {1, 0}, {1, 1}, {2, 2}, {3, 1}, {3, 3}, {4, 0}, {4, 4}};
+    patterns.push_back({"explicit layout", layout});
+
+    for(const auto &named : patterns){
+        BlockIndex index = BlockIndex::build(named.second, Q.size());
+        auto sparse = AttentionCommon::createMatrix(Q.size(), V[0].size());
+        BlockSparseAttention::attend(Q, K, V, index, scale, HeadView{&sparse, 0, static_cast<int>(V[0].size())});
+        auto dense = BlockSparseAttention::attendDense(Q, K, V, index.toMask(), scale);
+        cout << named.first << " (density " << index.density() << "): max |delta| = "
+             << AttentionCommon::maxAbsDiff(sparse, dense) << "\n";
+    }
+}
+
 int main(){
     cout << "=======    ATTENTION MECHANISMS COMPARISION    ======\n\n";
 
@@ -39,14 +182,49 @@ int main(){
 
     cout << "GROUPED-QUERY ATTENTION (MHA)\n";
     vector<vector<float>> gqa_output; 
+    unique_ptr<GroupedQueryAttention> gqa;
     try{
-        GroupedQueryAttention gqa(NUM_HEADS, NUM_KV_HEADS, D_MODEL);
-        gqa.printMemoryUsage(textEmbedding);
-        gqa_output = gqa.forward(textEmbedding);
+        gqa = make_unique<GroupedQueryAttention>(NUM_HEADS, NUM_KV_HEADS, D_MODEL);
+        gqa->printMemoryUsage(textEmbedding);
+        gqa_output = gqa->forward(textEmbedding);
         cout << "GQA Output shape: " << gqa_output.size() << " x " << gqa_output[0].size() << "\n\n\n";
     }catch(const exception &e){
         cout << "ERROR creating GQA: " << e.what() << "\n";
+        gqa.reset();
     }
+
+    // each report has its own handler : a failure in one is not a GQA construction error
+    auto report = [](const string &title, const function<void()> &body){
+        cout << "=== " << title << " ===\n";
+        try{
+            body();
+        }catch(const exception &e){
+            cout << "ERROR in " << title << ": " << e.what() << "\n";
+        }
+        cout << "\n";
+    };
+
+    report("Reduced Precision Accuracy (vs fp32)", [&](){
+        reportPrecisionDeltas(mha, textEmbedding, "MHA");
+        reportPrecisionDeltas(mqa, textEmbedding, "MQA");
+        if(gqa){ reportPrecisionDeltas(*gqa, textEmbedding, "GQA"); }
+    });
+
+    const string STREAM_FILE = "stream_embeddings.bin";
+    report("Streaming Chunked Prefill (causal)", [&](){
+        MappedEmbeddingFile::write(STREAM_FILE, textEmbedding);
+        reportStreamingDeltas(mha, textEmbedding, STREAM_FILE, "MHA");
+        reportStreamingDeltas(mqa, textEmbedding, STREAM_FILE, "MQA");
+        if(gqa){ reportStreamingDeltas(*gqa, textEmbedding, STREAM_FILE, "GQA"); }
+    });
+    remove(STREAM_FILE.c_str());
+
+    report("Block-Sparse Attention (vs dense with the equivalent mask)", [&](){
+        reportBlockSparsePatterns(TEXT);
+        reportBlockSparseDense(mha, textEmbedding, "MHA");
+        reportBlockSparseDense(mqa, textEmbedding, "MQA");
+        if(gqa){ reportBlockSparseDense(*gqa, textEmbedding, "GQA"); }
+    });
     
 
     // Demonstrate text reconstruction (simplified)
@@ -61,4 +239,12 @@ int main(){
     
     auto reconstructed_gqa = AttentionCommon::embeddingToText(gqa_output);
     cout << "GQA reconstructed: " << reconstructed_gqa << "\n";
+
+#ifdef ATTENTION_TRACE
+    cout << "\n";
+    AttentionTrace::printSummary();
+    if(AttentionTrace::writeChromeTrace("attention_trace.json")){
+        cout << "Trace written to attention_trace.json\n";
+    }
+#endif
 }
\ No newline at end of file
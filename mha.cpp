@@ -1,5 +1,7 @@
 # include "mha.hpp"
 # include "attention_common.hpp"
+# include "attention_trace.hpp"
+# include "kv_cache.hpp"
 
 # include <vector>
 # include <random>
@@ -10,6 +12,7 @@ MultiHeadAttention::MultiHeadAttention(int num_heads, int d_model)
 : num_heads(num_heads), d_model(d_model){
     d_k = (int)(d_model / num_heads);            // (d_k same as d_q)
     d_v = (int)(d_model / num_heads);
+    precision = Precision::FP32;
     initializeWeights();
 }
 
@@ -59,16 +62,24 @@ void MultiHeadAttention::initializeWeights(){
 }
 
 vector<vector<float>> MultiHeadAttention::forward(const vector<vector<float>> &X){
+    if(precision != Precision::FP32){
+        return forwardReducedPrecision(X);
+    }
+    ATTN_TRACE_SCOPE("mha", "forward", -1);
     int seq_len = X.size();
 
-    vector<vector<float>> output(seq_len, vector<float>(d_model, 0.0f));
-    vector<vector<vector<float>>> head_outputs(num_heads);
+    // [seq, num_heads, d_v] : every head writes its AV result into its own slice
+    vector<vector<float>> heads(seq_len, vector<float>(num_heads * d_v, 0.0f));
 
     for(int h = 0 ; h < num_heads ; ++h){
+        ATTN_TRACE_BEGIN(qkv_span, "mha", "qkv_projection", h);
         auto Q = AttentionCommon::matmul(X, W_q[h]);
         auto K = AttentionCommon::matmul(X, W_k[h]);
         auto V = AttentionCommon::matmul(X, W_v[h]);
+        ATTN_TRACE_END(qkv_span);
+        ATTN_TRACE_COUNT("mha", "flops", h, 2.0 * seq_len * d_model * (2 * d_k + d_v));
 
+        ATTN_TRACE_BEGIN(scores_span, "mha", "scores", h);
         auto K_t = AttentionCommon::transpose(K);
         auto scores = AttentionCommon::matmul(Q, K_t);
 
@@ -78,23 +89,24 @@ vector<vector<float>> MultiHeadAttention::forward(const vector<vector<float>> &X
                 val *= (scale);              // normalized for stability
             }
         }
+        ATTN_TRACE_END(scores_span);
+        ATTN_TRACE_COUNT("mha", "flops", h, 2.0 * seq_len * seq_len * d_k);
 
+        ATTN_TRACE_BEGIN(softmax_span, "mha", "softmax", h);
         auto attention_weights = AttentionCommon::softmax(scores);
+        ATTN_TRACE_END(softmax_span);
 
         // apply attention to values with the attention context vector from above step
-        auto head_result = AttentionCommon::matmul(attention_weights, V);
-        head_outputs[h] = head_result;
+        ATTN_TRACE_BEGIN(av_span, "mha", "av", h);
+        AttentionCommon::matmulInto(attention_weights, V, splitHeads(heads, h));
+        ATTN_TRACE_END(av_span);
+        ATTN_TRACE_COUNT("mha", "flops", h, 2.0 * seq_len * seq_len * d_v);
     }
 
-    // concatenate outputs of each head to get final context vector
-    for(int h = 0 ; h < num_heads ; ++h){
-        for(int i = 0 ; i < seq_len ; ++i){
-            for(int j = 0 ; j < d_v ; ++j){
-                output[i][h * d_v + j] = head_outputs[h][i][j];
-            }
-        }
-    } 
-    output = AttentionCommon::matmul(output, W_o);
+    ATTN_TRACE_BEGIN(out_span, "mha", "output_projection", -1);
+    auto output = AttentionCommon::matmul(combineHeads(heads), W_o);
+    ATTN_TRACE_END(out_span);
+    ATTN_TRACE_COUNT("mha", "flops", -1, 2.0 * seq_len * d_model * d_model);
     return output;
 }
 
@@ -106,10 +118,14 @@ void MultiHeadAttention::printMemoryUsage(const vector<vector<float>> &X){
         auto V = AttentionCommon::matmul(X, W_v[h]);
         kv_cache_memory += AttentionCommon::calculateMemoryKB(K) + AttentionCommon::calculateMemoryKB(V);
     }
+    // K / V are held at the storage precision
+    kv_cache_memory = (kv_cache_memory * ReducedPrecision::bytesPerElement(precision)) / sizeof(float);
+
     std::cout << "=== Multi-Head Attention Memory Usage ===\n";
     std::cout << "Number of heads: " << num_heads << "\n";
     std::cout << "Model dimension: " << d_model << "\n";
     std::cout << "Head dimension (d_k): " << d_k << "\n";
+    std::cout << "Storage precision: " << ReducedPrecision::name(precision) << "\n";
     std::cout << "KV Cache Memory: " << kv_cache_memory << " KB\n";
     std::cout << "Total Parameters: " << ((num_heads * 3 * d_model * d_k) + (d_model * d_model)) << "\n";
     std::cout << "=========================================\n\n";
@@ -135,4 +151,211 @@ vector<vector<vector<float>>> MultiHeadAttention::getAttentionWeights(const vect
         all_attention_weights.push_back(attention_weights);
     }
     return all_attention_weights;
-} 
\ No newline at end of file
+} 
+
+HeadView MultiHeadAttention::splitHeads(vector<vector<float>> &heads, int head){
+    return HeadView{&heads, head * d_v, d_v};
+}
+
+const vector<vector<float>>& MultiHeadAttention::combineHeads(const vector<vector<float>> &heads){
+    // heads are already laid out as concat(h1, h2, ... h(num_heads)) per row
+    return heads;
+}
+
+void MultiHeadAttention::setPrecision(Precision precision){
+    this->precision = precision;
+    W_q_half.clear();
+    W_k_half.clear();
+    W_v_half.clear();
+    W_o_half = HalfMatrix();
+    if(precision == Precision::FP32){
+        return;
+    }
+
+    for(int h = 0 ; h < num_heads ; ++h){
+        W_q_half.push_back(ReducedPrecision::quantize(W_q[h], precision));
+    }
+    for(int h = 0 ; h < num_heads ; ++h){
+        W_k_half.push_back(ReducedPrecision::quantize(W_k[h], precision));
+        W_v_half.push_back(ReducedPrecision::quantize(W_v[h], precision));
+    }
+
+    // only the W_o rows that the concatenated heads reach
+    W_o_half = ReducedPrecision::quantize(vector<vector<float>>(W_o.begin(), W_o.begin() + num_heads * d_v), precision);
+}
+
+Precision MultiHeadAttention::getPrecision() const{
+    return precision;
+}
+
+vector<vector<float>> MultiHeadAttention::forwardReducedPrecision(const vector<vector<float>> &X){
+    ATTN_TRACE_SCOPE("mha", "forward_reduced_precision", -1);
+    // stages are traced under "mha_half" so they stay apart from the fp32 ones
+    int seq_len = X.size();
+    auto X_half = ReducedPrecision::quantize(X, precision);
+
+    // [seq, num_heads, d_v] in 16-bit storage
+    auto heads = ReducedPrecision::createMatrix(seq_len, num_heads * d_v, precision);
+
+    for(int h = 0 ; h < num_heads ; ++h){
+        ATTN_TRACE_BEGIN(qkv_span, "mha_half", "qkv_projection", h);
+        auto Q = ReducedPrecision::matmul(X_half, W_q_half[h]);
+        auto K = ReducedPrecision::matmul(X_half, W_k_half[h]);
+        auto V = ReducedPrecision::matmul(X_half, W_v_half[h]);
+        ATTN_TRACE_END(qkv_span);
+        ATTN_TRACE_COUNT("mha_half", "flops", h, 2.0 * seq_len * d_model * (2 * d_k + d_v));
+
+        // scores and softmax are computed in fp32
+        ATTN_TRACE_BEGIN(scores_span, "mha_half", "scores", h);
+        auto scores = ReducedPrecision::matmulTransposed(Q, K);
+        float scale = 1.0f / std::sqrt(static_cast<float>(d_k));
+        for (auto& row : scores) {
+            for (auto& val : row) {
+                val *= scale;
+            }
+        }
+        ATTN_TRACE_END(scores_span);
+        ATTN_TRACE_COUNT("mha_half", "flops", h, 2.0 * seq_len * seq_len * d_k);
+
+        ATTN_TRACE_BEGIN(softmax_span, "mha_half", "softmax", h);
+        auto attention_weights = AttentionCommon::softmax(scores);
+        ATTN_TRACE_END(softmax_span);
+
+        ATTN_TRACE_BEGIN(av_span, "mha_half", "av", h);
+        ReducedPrecision::matmulInto(attention_weights, V, heads, h * d_v);
+        ATTN_TRACE_END(av_span);
+        ATTN_TRACE_COUNT("mha_half", "flops", h, 2.0 * seq_len * seq_len * d_v);
+    }
+
+    ATTN_TRACE_BEGIN(out_span, "mha_half", "output_projection", -1);
+    auto output = ReducedPrecision::matmulFloat(heads, W_o_half);
+    ATTN_TRACE_END(out_span);
+    ATTN_TRACE_COUNT("mha_half", "flops", -1, 2.0 * seq_len * d_model * d_model);
+    return output;
+}
+
+void MultiHeadAttention::prefillStreaming(EmbeddingSource &source, int chunk_size, int window,
+                          const function<void(long long, const vector<vector<float>>&)> &sink){
+    if(source.dim() != d_model){
+        throw invalid_argument("embedding source width does not match d_model");
+    }
+    RollingKVCache cache(num_heads, d_k, d_v, window, chunk_size, precision);
+    float scale = 1.0f / std::sqrt(static_cast<float>(d_k));
+
+    vector<vector<float>> X;
+    long long start = 0;
+    while(int rows = source.next(chunk_size, X)){
+        ATTN_TRACE_SCOPE("mha", "prefill_chunk", -1);
+
+        if(precision != Precision::FP32){
+            // same storage as forwardReducedPrecision : 16-bit X, K/V and heads, fp32 scores
+            auto X_half = ReducedPrecision::quantize(X, precision);
+            vector<HalfMatrix> K_half, V_half;
+            for(int h = 0 ; h < num_heads ; ++h){
+                K_half.push_back(ReducedPrecision::matmul(X_half, W_k_half[h]));
+                V_half.push_back(ReducedPrecision::matmul(X_half, W_v_half[h]));
+            }
+            cache.append(K_half, V_half);
+
+            vector<vector<float>> heads(rows, vector<float>(num_heads * d_v, 0.0f));
+            for(int h = 0 ; h < num_heads ; ++h){
+                auto Q = ReducedPrecision::dequantize(ReducedPrecision::matmul(X_half, W_q_half[h]));
+                cache.attend(h, Q, scale, splitHeads(heads, h));
+            }
+
+            sink(start, ReducedPrecision::matmulFloat(ReducedPrecision::quantize(heads, precision), W_o_half));
+        }else{
+            vector<vector<vector<float>>> K_chunk, V_chunk;
+            for(int h = 0 ; h < num_heads ; ++h){
+                K_chunk.push_back(AttentionCommon::matmul(X, W_k[h]));
+                V_chunk.push_back(AttentionCommon::matmul(X, W_v[h]));
+            }
+            cache.append(K_chunk, V_chunk);
+
+            vector<vector<float>> heads(rows, vector<float>(num_heads * d_v, 0.0f));
+            for(int h = 0 ; h < num_heads ; ++h){
+                auto Q = AttentionCommon::matmul(X, W_q[h]);
+                cache.attend(h, Q, scale, splitHeads(heads, h));
+            }
+
+            sink(start, AttentionCommon::matmul(combineHeads(heads), W_o));
+        }
+        start += rows;
+    }
+}
+
+vector<vector<float>> MultiHeadAttention::forwardBlockSparse(const vector<vector<float>> &X, const BlockSparsePattern &pattern){
+    ATTN_TRACE_SCOPE("mha", "forward_block_sparse", -1);
+    int seq_len = X.size();
+
+    // the block index depends only on the pattern and length : built once for all heads
+    BlockIndex index = BlockIndex::build(pattern, seq_len);
+    float scale = 1.0f / std::sqrt(static_cast<float>(d_k));
+
+    // with bf16 / fp16 selected the projections and heads are 16-bit, as in forwardReducedPrecision;
+    // the tiles are scored in fp32 either way
+    bool fp32 = (precision == Precision::FP32);
+    HalfMatrix X_half;
+    if(!fp32){
+        X_half = ReducedPrecision::quantize(X, precision);
+    }
+
+    vector<vector<float>> heads(seq_len, vector<float>(num_heads * d_v, 0.0f));
+    for(int h = 0 ; h < num_heads ; ++h){
+        ATTN_TRACE_BEGIN(qkv_span, "mha_sparse", "qkv_projection", h);
+        auto Q = fp32 ? AttentionCommon::matmul(X, W_q[h])
+                      : ReducedPrecision::dequantize(ReducedPrecision::matmul(X_half, W_q_half[h]));
+        auto K = fp32 ? AttentionCommon::matmul(X, W_k[h])
+                      : ReducedPrecision::dequantize(ReducedPrecision::matmul(X_half, W_k_half[h]));
+        auto V = fp32 ? AttentionCommon::matmul(X, W_v[h])
+                      : ReducedPrecision::dequantize(ReducedPrecision::matmul(X_half, W_v_half[h]));
+        ATTN_TRACE_END(qkv_span);
+        ATTN_TRACE_COUNT("mha_sparse", "flops", h, 2.0 * seq_len * d_model * (2 * d_k + d_v));
+
+        ATTN_TRACE_BEGIN(attend_span, "mha_sparse", "scores_softmax_av", h);
+        BlockSparseAttention::attend(Q, K, V, index, scale, splitHeads(heads, h));
+        ATTN_TRACE_END(attend_span);
+        ATTN_TRACE_COUNT("mha_sparse", "flops", h, 2.0 * index.nnzEntries() * (d_k + d_v));
+    }
+
+    ATTN_TRACE_BEGIN(out_span, "mha_sparse", "output_projection", -1);
+    auto output = fp32 ? AttentionCommon::matmul(combineHeads(heads), W_o)
+                       : ReducedPrecision::matmulFloat(ReducedPrecision::quantize(heads, precision), W_o_half);
+    ATTN_TRACE_END(out_span);
+    ATTN_TRACE_COUNT("mha_sparse", "flops", -1, 2.0 * seq_len * d_model * d_model);
+    return output;
+}
+
+AttentionShard MultiHeadAttention::makeShard(int rank, int world) const{
+    if(world <= 0 || rank < 0 || rank >= world){
+        throw invalid_argument("shard rank must be in [0, world) with world > 0");
+    }
+    if((num_heads % world) != 0){
+        throw invalid_argument("num_heads must be divisible by the number of shards");
+    }
+    int local_heads = (num_heads / world);
+    int first_head = (rank * local_heads);
+
+    AttentionShard shard;
+    shard.d_model = d_model;
+    shard.num_heads = local_heads;
+    shard.num_kv_heads = local_heads;
+    shard.d_k = d_k;
+    shard.d_v = d_v;
+    shard.W_q.assign(W_q.begin() + first_head, W_q.begin() + first_head + local_heads);
+    shard.W_k.assign(W_k.begin() + first_head, W_k.begin() + first_head + local_heads);
+    shard.W_v.assign(W_v.begin() + first_head, W_v.begin() + first_head + local_heads);
+
+    // rows of W_o that multiply this shard's slice of the concatenated heads
+    shard.W_o.assign(W_o.begin() + first_head * d_v, W_o.begin() + (first_head + local_heads) * d_v);
+
+    // the 16-bit copies, so the shards reproduce forward() in the selected precision
+    shard.precision = precision;
+    if(precision != Precision::FP32){
+        shard.W_q_half.assign(W_q_half.begin() + first_head, W_q_half.begin() + first_head + local_heads);
+        shard.W_k_half.assign(W_k_half.begin() + first_head, W_k_half.begin() + first_head + local_heads);
+        shard.W_v_half.assign(W_v_half.begin() + first_head, W_v_half.begin() + first_head + local_heads);
+        shard.W_o_half = ReducedPrecision::quantize(shard.W_o, precision);
+    }
+    return shard;
+}
\ No newline at end of file
@@ -2,7 +2,12 @@
 # define MHA_HPP 
 
 # include "attention_common.hpp"
+# include "reduced_precision.hpp"
+# include "embedding_stream.hpp"
+# include "block_sparse.hpp"
+# include "tensor_parallel.hpp"
 # include <vector>
+# include <functional>
 
 class MultiHeadAttention{
     private:
@@ -18,6 +23,13 @@ class MultiHeadAttention{
 
         // 2D shape of output weight : [D_model, D_model] (D_model => N_heads * dim_head)
         std::vector<std::vector<float>> W_o;
+
+        // 16-bit copies of the weights, built by setPrecision() (the fp32 weights stay as reference)
+        Precision precision;
+        std::vector<HalfMatrix> W_q_half;
+        std::vector<HalfMatrix> W_k_half;
+        std::vector<HalfMatrix> W_v_half;
+        HalfMatrix W_o_half;
     
     public:
     // constructor
@@ -25,6 +37,23 @@ class MultiHeadAttention{
 
         std::vector<std::vector<float>> forward(const std::vector<std::vector<float>>& X);
 
+        // attention restricted to the tiles of a block-sparse pattern (same projections and storage precision as forward)
+        std::vector<std::vector<float>> forwardBlockSparse(const std::vector<std::vector<float>> &X, const BlockSparsePattern &pattern);
+
+        // storage precision of weights, activations and K/V (accumulation always fp32)
+        void setPrecision(Precision precision);
+        Precision getPrecision() const;
+
+        /* Causal prefill of a stream too long to hold at once : input is read chunk_size rows
+           at a time, K/V go into a rolling cache of 'window' tokens and every chunk's output is
+           passed to sink(start_position, output) before the next chunk is read. The cache and
+           projections use the storage precision set by setPrecision(). */
+        void prefillStreaming(EmbeddingSource &source, int chunk_size, int window,
+                              const std::function<void(long long, const std::vector<std::vector<float>>&)> &sink);
+
+        // heads [rank * H / world, (rank + 1) * H / world) with their W_o rows (num_heads % world == 0)
+        AttentionShard makeShard(int rank, int world) const;
+
         // Memory usage analysis
         void printMemoryUsage(const std::vector<std::vector<float>> &x);
 
@@ -33,8 +62,13 @@ class MultiHeadAttention{
 
     private:
         void initializeWeights();
-        std::vector<std::vector<float>> splitHeads(const std::vector<std::vector<float>>& X, int head_size);
-        std::vector<std::vector<float>> combineHeads(const std::vector<std::vector<float>>& X);      
+
+        // fp32 forward() with 16-bit storage (see setPrecision)
+        std::vector<std::vector<float>> forwardReducedPrecision(const std::vector<std::vector<float>> &X);
+        // head h of a [seq, num_heads * d_v] buffer, as a view (no copy)
+        HeadView splitHeads(std::vector<std::vector<float>> &heads, int head);
+        // merged heads feed W_o directly : the buffer already is the concatenation
+        const std::vector<std::vector<float>>& combineHeads(const std::vector<std::vector<float>> &heads);
 };
 
 # endif
\ No newline at end of file
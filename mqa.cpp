@@ -1,5 +1,7 @@
 # include "mqa.hpp"
 # include "attention_common.hpp"
+# include "attention_trace.hpp"
+# include "kv_cache.hpp"
 
 # include <vector>
 # include <random>
@@ -10,6 +12,7 @@ MultiQueryAttention::MultiQueryAttention(int num_heads, int d_model)
 : num_heads(num_heads), d_model(d_model){
     d_k = (d_model / num_heads);
     d_v = (d_model / num_heads);
+    precision = Precision::FP32;
     initializeWeights();
 }
 
@@ -48,15 +51,28 @@ void MultiQueryAttention::initializeWeights(){
 }
 
 vector<vector<float>> MultiQueryAttention::forward(const vector<vector<float>> &X){
+    if(precision != Precision::FP32){
+        return forwardReducedPrecision(X);
+    }
+    ATTN_TRACE_SCOPE("mqa", "forward", -1);
     int seq_len = X.size();
-    vector<vector<float>> output(seq_len, vector<float>(d_model, 0.0f));
-    vector<vector<vector<float>>> head_outputs(num_heads);
+    // [seq, num_heads, d_v] : every head writes its AV result into its own slice
+    vector<vector<float>> heads(seq_len, vector<float>(num_heads * d_v, 0.0f));
 
+    // single shared K / V projection (kv head 0)
+    ATTN_TRACE_BEGIN(kv_span, "mqa", "kv_projection", 0);
     auto K = AttentionCommon::matmul(X, W_k);
     auto V = AttentionCommon::matmul(X, W_v);
+    ATTN_TRACE_END(kv_span);
+    ATTN_TRACE_COUNT("mqa", "kv_flops", 0, 2.0 * seq_len * d_model * (d_k + d_v));
+
     for(int h = 0 ; h < num_heads ; ++h){
+        ATTN_TRACE_BEGIN(q_span, "mqa", "qkv_projection", h);
         auto Q = AttentionCommon::matmul(X, W_q[h]);
+        ATTN_TRACE_END(q_span);
+        ATTN_TRACE_COUNT("mqa", "flops", h, 2.0 * seq_len * d_model * d_k);
 
+        ATTN_TRACE_BEGIN(scores_span, "mqa", "scores", h);
         auto K_t = AttentionCommon::transpose(K);
         auto scores = AttentionCommon::matmul(Q, K_t);
 
@@ -66,22 +82,24 @@ vector<vector<float>> MultiQueryAttention::forward(const vector<vector<float>> &
                 val *= scale;
             }
         }
+        ATTN_TRACE_END(scores_span);
+        ATTN_TRACE_COUNT("mqa", "flops", h, 2.0 * seq_len * seq_len * d_k);
         
+        ATTN_TRACE_BEGIN(softmax_span, "mqa", "softmax", h);
         auto attention_weights = AttentionCommon::softmax(scores);
-        head_outputs[h] = AttentionCommon::matmul(attention_weights, V);
-    }
+        ATTN_TRACE_END(softmax_span);
 
-    // concatenating heads
-    for(int h = 0 ; h < num_heads ; ++h){
-        for(int i = 0 ; i < seq_len ; ++i){
-            for(int j = 0 ; j < d_v ; ++j){
-                output[i][h * d_v + j] = head_outputs[h][i][j];
-            }
-        }
+        ATTN_TRACE_BEGIN(av_span, "mqa", "av", h);
+        AttentionCommon::matmulInto(attention_weights, V, splitHeads(heads, h));
+        ATTN_TRACE_END(av_span);
+        ATTN_TRACE_COUNT("mqa", "flops", h, 2.0 * seq_len * seq_len * d_v);
     }
 
     // final Linear projection
-    output = AttentionCommon::matmul(output, W_o);
+    ATTN_TRACE_BEGIN(out_span, "mqa", "output_projection", -1);
+    auto output = AttentionCommon::matmul(combineHeads(heads), W_o);
+    ATTN_TRACE_END(out_span);
+    ATTN_TRACE_COUNT("mqa", "flops", -1, 2.0 * seq_len * d_model * d_model);
     return output;
 }
 
@@ -92,10 +110,14 @@ void MultiQueryAttention::printMemoryUsage(const vector<vector<float>>& X){
     
     size_t kv_cache_memory = (AttentionCommon::calculateMemoryKB(K) + AttentionCommon::calculateMemoryKB(V));
     
+    // K / V are held at the storage precision
+    kv_cache_memory = (kv_cache_memory * ReducedPrecision::bytesPerElement(precision)) / sizeof(float);
+
     cout << "=== Multi-Query Attention Memory Usage ===\n";
     cout << "Number of heads: " << num_heads << "\n";
     cout << "Model dimension: " << d_model << "\n";
     cout << "Head dimension (d_k): " << d_k << "\n";
+    cout << "Storage precision: " << ReducedPrecision::name(precision) << "\n";
     cout << "KV Cache Memory: " << kv_cache_memory << " KB\n";
     cout << "Total Parameters: " << (num_heads * d_model * d_k + 2 * d_model * d_k + d_model * d_model) << "\n";
     cout << "==========================================\n\n";
@@ -122,4 +144,213 @@ vector<vector<vector<float>>> MultiQueryAttention::getAttentionWeights(const std
     }
     
     return all_attention_weights;
+}
+
+HeadView MultiQueryAttention::splitHeads(vector<vector<float>> &heads, int head){
+    return HeadView{&heads, head * d_v, d_v};
+}
+
+const vector<vector<float>>& MultiQueryAttention::combineHeads(const vector<vector<float>> &heads){
+    // heads are already laid out as concat(h1, h2, ... h(num_heads)) per row
+    return heads;
+}
+
+void MultiQueryAttention::setPrecision(Precision precision){
+    this->precision = precision;
+    W_q_half.clear();
+    W_k_half = HalfMatrix();
+    W_v_half = HalfMatrix();
+    W_o_half = HalfMatrix();
+    if(precision == Precision::FP32){
+        return;
+    }
+
+    for(int h = 0 ; h < num_heads ; ++h){
+        W_q_half.push_back(ReducedPrecision::quantize(W_q[h], precision));
+    }
+    W_k_half = ReducedPrecision::quantize(W_k, precision);
+    W_v_half = ReducedPrecision::quantize(W_v, precision);
+
+    // only the W_o rows that the concatenated heads reach
+    W_o_half = ReducedPrecision::quantize(vector<vector<float>>(W_o.begin(), W_o.begin() + num_heads * d_v), precision);
+}
+
+Precision MultiQueryAttention::getPrecision() const{
+    return precision;
+}
+
+vector<vector<float>> MultiQueryAttention::forwardReducedPrecision(const vector<vector<float>> &X){
+    ATTN_TRACE_SCOPE("mqa", "forward_reduced_precision", -1);
+    // stages are traced under "mqa_half" so they stay apart from the fp32 ones
+    int seq_len = X.size();
+    auto X_half = ReducedPrecision::quantize(X, precision);
+
+    // [seq, num_heads, d_v] in 16-bit storage
+    auto heads = ReducedPrecision::createMatrix(seq_len, num_heads * d_v, precision);
+
+    ATTN_TRACE_BEGIN(kv_span, "mqa_half", "kv_projection", 0);
+    auto K = ReducedPrecision::matmul(X_half, W_k_half);
+    auto V = ReducedPrecision::matmul(X_half, W_v_half);
+    ATTN_TRACE_END(kv_span);
+    ATTN_TRACE_COUNT("mqa_half", "kv_flops", 0, 2.0 * seq_len * d_model * (d_k + d_v));
+
+    for(int h = 0 ; h < num_heads ; ++h){
+        ATTN_TRACE_BEGIN(q_span, "mqa_half", "qkv_projection", h);
+        auto Q = ReducedPrecision::matmul(X_half, W_q_half[h]);
+        ATTN_TRACE_END(q_span);
+        ATTN_TRACE_COUNT("mqa_half", "flops", h, 2.0 * seq_len * d_model * d_k);
+
+        // scores and softmax are computed in fp32
+        ATTN_TRACE_BEGIN(scores_span, "mqa_half", "scores", h);
+        auto scores = ReducedPrecision::matmulTransposed(Q, K);
+        float scale = 1.0f / std::sqrt(static_cast<float>(d_k));
+        for (auto& row : scores) {
+            for (auto& val : row) {
+                val *= scale;
+            }
+        }
+        ATTN_TRACE_END(scores_span);
+        ATTN_TRACE_COUNT("mqa_half", "flops", h, 2.0 * seq_len * seq_len * d_k);
+
+        ATTN_TRACE_BEGIN(softmax_span, "mqa_half", "softmax", h);
+        auto attention_weights = AttentionCommon::softmax(scores);
+        ATTN_TRACE_END(softmax_span);
+
+        ATTN_TRACE_BEGIN(av_span, "mqa_half", "av", h);
+        ReducedPrecision::matmulInto(attention_weights, V, heads, h * d_v);
+        ATTN_TRACE_END(av_span);
+        ATTN_TRACE_COUNT("mqa_half", "flops", h, 2.0 * seq_len * seq_len * d_v);
+    }
+
+    ATTN_TRACE_BEGIN(out_span, "mqa_half", "output_projection", -1);
+    auto output = ReducedPrecision::matmulFloat(heads, W_o_half);
+    ATTN_TRACE_END(out_span);
+    ATTN_TRACE_COUNT("mqa_half", "flops", -1, 2.0 * seq_len * d_model * d_model);
+    return output;
+}
+
+void MultiQueryAttention::prefillStreaming(EmbeddingSource &source, int chunk_size, int window,
+                          const function<void(long long, const vector<vector<float>>&)> &sink){
+    if(source.dim() != d_model){
+        throw invalid_argument("embedding source width does not match d_model");
+    }
+    RollingKVCache cache(1, d_k, d_v, window, chunk_size, precision);
+    float scale = 1.0f / std::sqrt(static_cast<float>(d_k));
+
+    vector<vector<float>> X;
+    long long start = 0;
+    while(int rows = source.next(chunk_size, X)){
+        ATTN_TRACE_SCOPE("mqa", "prefill_chunk", -1);
+
+        if(precision != Precision::FP32){
+            // same storage as forwardReducedPrecision : 16-bit X, K/V and heads, fp32 scores
+            auto X_half = ReducedPrecision::quantize(X, precision);
+            vector<HalfMatrix> K_half, V_half;
+            K_half.push_back(ReducedPrecision::matmul(X_half, W_k_half));
+            V_half.push_back(ReducedPrecision::matmul(X_half, W_v_half));
+            cache.append(K_half, V_half);
+
+            vector<vector<float>> heads(rows, vector<float>(num_heads * d_v, 0.0f));
+            for(int h = 0 ; h < num_heads ; ++h){
+                auto Q = ReducedPrecision::dequantize(ReducedPrecision::matmul(X_half, W_q_half[h]));
+                cache.attend(0, Q, scale, splitHeads(heads, h));
+            }
+
+            sink(start, ReducedPrecision::matmulFloat(ReducedPrecision::quantize(heads, precision), W_o_half));
+        }else{
+            vector<vector<vector<float>>> K_chunk, V_chunk;
+            K_chunk.push_back(AttentionCommon::matmul(X, W_k));
+            V_chunk.push_back(AttentionCommon::matmul(X, W_v));
+            cache.append(K_chunk, V_chunk);
+
+            vector<vector<float>> heads(rows, vector<float>(num_heads * d_v, 0.0f));
+            for(int h = 0 ; h < num_heads ; ++h){
+                auto Q = AttentionCommon::matmul(X, W_q[h]);
+                cache.attend(0, Q, scale, splitHeads(heads, h));
+            }
+
+            sink(start, AttentionCommon::matmul(combineHeads(heads), W_o));
+        }
+        start += rows;
+    }
+}
+
+vector<vector<float>> MultiQueryAttention::forwardBlockSparse(const vector<vector<float>> &X, const BlockSparsePattern &pattern){
+    ATTN_TRACE_SCOPE("mqa", "forward_block_sparse", -1);
+    int seq_len = X.size();
+
+    // the block index depends only on the pattern and length : built once for all heads
+    BlockIndex index = BlockIndex::build(pattern, seq_len);
+    float scale = 1.0f / std::sqrt(static_cast<float>(d_k));
+
+    // with bf16 / fp16 selected the projections and heads are 16-bit, as in forwardReducedPrecision;
+    // the tiles are scored in fp32 either way
+    bool fp32 = (precision == Precision::FP32);
+    HalfMatrix X_half;
+    if(!fp32){
+        X_half = ReducedPrecision::quantize(X, precision);
+    }
+
+    vector<vector<float>> heads(seq_len, vector<float>(num_heads * d_v, 0.0f));
+    ATTN_TRACE_BEGIN(kv_span, "mqa_sparse", "kv_projection", 0);
+    auto K = fp32 ? AttentionCommon::matmul(X, W_k)
+                  : ReducedPrecision::dequantize(ReducedPrecision::matmul(X_half, W_k_half));
+    auto V = fp32 ? AttentionCommon::matmul(X, W_v)
+                  : ReducedPrecision::dequantize(ReducedPrecision::matmul(X_half, W_v_half));
+    ATTN_TRACE_END(kv_span);
+    ATTN_TRACE_COUNT("mqa_sparse", "kv_flops", 0, 2.0 * seq_len * d_model * (d_k + d_v));
+
+    for(int h = 0 ; h < num_heads ; ++h){
+        ATTN_TRACE_BEGIN(q_span, "mqa_sparse", "qkv_projection", h);
+        auto Q = fp32 ? AttentionCommon::matmul(X, W_q[h])
+                      : ReducedPrecision::dequantize(ReducedPrecision::matmul(X_half, W_q_half[h]));
+        ATTN_TRACE_END(q_span);
+        ATTN_TRACE_COUNT("mqa_sparse", "flops", h, 2.0 * seq_len * d_model * d_k);
+
+        ATTN_TRACE_BEGIN(attend_span, "mqa_sparse", "scores_softmax_av", h);
+        BlockSparseAttention::attend(Q, K, V, index, scale, splitHeads(heads, h));
+        ATTN_TRACE_END(attend_span);
+        ATTN_TRACE_COUNT("mqa_sparse", "flops", h, 2.0 * index.nnzEntries() * (d_k + d_v));
+    }
+
+    ATTN_TRACE_BEGIN(out_span, "mqa_sparse", "output_projection", -1);
+    auto output = fp32 ? AttentionCommon::matmul(combineHeads(heads), W_o)
+                       : ReducedPrecision::matmulFloat(ReducedPrecision::quantize(heads, precision), W_o_half);
+    ATTN_TRACE_END(out_span);
+    ATTN_TRACE_COUNT("mqa_sparse", "flops", -1, 2.0 * seq_len * d_model * d_model);
+    return output;
+}
+
+AttentionShard MultiQueryAttention::makeShard(int rank, int world) const{
+    if(world <= 0 || rank < 0 || rank >= world){
+        throw invalid_argument("shard rank must be in [0, world) with world > 0");
+    }
+    if((num_heads % world) != 0){
+        throw invalid_argument("num_heads must be divisible by the number of shards");
+    }
+    int local_heads = (num_heads / world);
+    int first_head = (rank * local_heads);
+
+    AttentionShard shard;
+    shard.d_model = d_model;
+    shard.num_heads = local_heads;
+    shard.num_kv_heads = 1;
+    shard.d_k = d_k;
+    shard.d_v = d_v;
+    shard.W_q.assign(W_q.begin() + first_head, W_q.begin() + first_head + local_heads);
+    shard.W_k.push_back(W_k);
+    shard.W_v.push_back(W_v);
+
+    // rows of W_o that multiply this shard's slice of the concatenated heads
+    shard.W_o.assign(W_o.begin() + first_head * d_v, W_o.begin() + (first_head + local_heads) * d_v);
+
+    // the 16-bit copies, so the shards reproduce forward() in the selected precision
+    shard.precision = precision;
+    if(precision != Precision::FP32){
+        shard.W_q_half.assign(W_q_half.begin() + first_head, W_q_half.begin() + first_head + local_heads);
+        shard.W_k_half.push_back(W_k_half);
+        shard.W_v_half.push_back(W_v_half);
+        shard.W_o_half = ReducedPrecision::quantize(shard.W_o, precision);
+    }
+    return shard;
 }
\ No newline at end of file
@@ -2,7 +2,12 @@
 # define MQA_HPP
 
 #include "attention_common.hpp"
+#include "reduced_precision.hpp"
+#include "embedding_stream.hpp"
+#include "block_sparse.hpp"
+#include "tensor_parallel.hpp"
 #include <vector>
+#include <functional>
 class MultiQueryAttention{
     private:
         int num_heads;
@@ -15,12 +20,33 @@ class MultiQueryAttention{
         std::vector<std::vector<float>> W_k;                // Single K projection
         std::vector<std::vector<float>> W_v;                // Single V projection
         std::vector<std::vector<float>> W_o;                // Output projection
+
+        // 16-bit copies of the weights, built by setPrecision() (the fp32 weights stay as reference)
+        Precision precision;
+        std::vector<HalfMatrix> W_q_half;
+        HalfMatrix W_k_half;
+        HalfMatrix W_v_half;
+        HalfMatrix W_o_half;
     
     public:
         MultiQueryAttention(int num_heads, int d_model);
 
         std::vector<std::vector<float>> forward(const std::vector<std::vector<float>>& X);
 
+        // block-sparse variant of forward() : only the pattern's tiles are scored, in the storage precision of setPrecision()
+        std::vector<std::vector<float>> forwardBlockSparse(const std::vector<std::vector<float>> &X, const BlockSparsePattern &pattern);
+
+        // storage precision of weights, activations and K/V (accumulation always fp32)
+        void setPrecision(Precision precision);
+        Precision getPrecision() const;
+
+        // chunked causal prefill, single shared K/V head in a rolling cache of 'window' tokens
+        void prefillStreaming(EmbeddingSource &source, int chunk_size, int window,
+                              const std::function<void(long long, const std::vector<std::vector<float>>&)> &sink);
+
+        // a slice of the query heads (num_heads % world == 0); the shared K/V head is replicated
+        AttentionShard makeShard(int rank, int world) const;
+
         // Memory usage analysis
         void printMemoryUsage(const std::vector<std::vector<float>> &x);
 
@@ -29,8 +55,13 @@ class MultiQueryAttention{
 
     private:
         void initializeWeights();
-        std::vector<std::vector<float>> splitHeads(const std::vector<std::vector<float>>& X, int head_size);
-        std::vector<std::vector<float>> combineHeads(const std::vector<std::vector<float>>& X);
+
+        // fp32 forward() with 16-bit storage (see setPrecision)
+        std::vector<std::vector<float>> forwardReducedPrecision(const std::vector<std::vector<float>> &X);
+        // head h of a [seq, num_heads * d_v] buffer, as a view (no copy)
+        HeadView splitHeads(std::vector<std::vector<float>> &heads, int head);
+        // merged heads feed W_o directly : the buffer already is the concatenation
+        const std::vector<std::vector<float>>& combineHeads(const std::vector<std::vector<float>> &heads);
 };
 
 # endif
@@ -0,0 +1,329 @@
+# include "reduced_precision.hpp"
+# include "attention_trace.hpp"
+
+# include <algorithm>
+# include <cstring>
+# include <stdexcept>
+
+# if defined(__F16C__) || defined(__AVX2__) || defined(__AVX512BF16__)
+# include <immintrin.h>
+# endif
+
+using namespace std;
+
+/*LOGIC FOR:
+
+1] scalar fp32 <-> bf16 / fp16 (round to nearest even, inf / nan / subnormals kept)
+2] bulk encode / decode (F16C, AVX512-BF16, AVX2 when available)
+3] quantize / dequantize nested matrices
+4] GEMMs with fp32 accumulation (A x B, A x B^T, P x V into a head slice)
+5] memory helpers
+
+*/
+
+uint16_t ReducedPrecision::floatToBf16(float value){
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+
+    if((bits & 0x7fffffffu) > 0x7f800000u){
+        return static_cast<uint16_t>((bits >> 16) | 0x0040u);     // keep nan quiet
+    }
+    bits += 0x7fffu + ((bits >> 16) & 1u);                         // round to nearest even
+    return static_cast<uint16_t>(bits >> 16);
+}
+
+float ReducedPrecision::bf16ToFloat(uint16_t value){
+    uint32_t bits = static_cast<uint32_t>(value) << 16;
+    float result;
+    memcpy(&result, &bits, sizeof(result));
+    return result;
+}
+
+uint16_t ReducedPrecision::floatToHalf(float value){
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+
+    uint32_t sign = (bits >> 16) & 0x8000u;
+    int32_t exponent = static_cast<int32_t>((bits >> 23) & 0xffu) - 127 + 15;
+    uint32_t mantissa = bits & 0x7fffffu;
+
+    if((bits & 0x7fffffffu) >= 0x7f800000u){
+        // inf stays inf, nan keeps its top payload bits and is made quiet
+        return static_cast<uint16_t>(sign | 0x7c00u | (mantissa ? (0x0200u | (mantissa >> 13)) : 0u));
+    }
+    if(exponent >= 31){
+        return static_cast<uint16_t>(sign | 0x7c00u);              // overflow => inf
+    }
+    if(exponent <= 0){
+        // subnormal half (or zero)
+        if(exponent < -10){
+            return static_cast<uint16_t>(sign);
+        }
+        mantissa |= 0x800000u;
+        int shift = 14 - exponent;
+        uint32_t half = mantissa >> shift;
+        uint32_t remainder = mantissa & ((1u << shift) - 1u);
+        uint32_t halfway = 1u << (shift - 1);
+        if(remainder > halfway || (remainder == halfway && (half & 1u))){
+            ++half;
+        }
+        return static_cast<uint16_t>(sign | half);
+    }
+
+    uint32_t half = sign | (static_cast<uint32_t>(exponent) << 10) | (mantissa >> 13);
+    uint32_t remainder = mantissa & 0x1fffu;
+    if(remainder > 0x1000u || (remainder == 0x1000u && (half & 1u))){
+        ++half;                                                    // a carry into the exponent is still correct
+    }
+    return static_cast<uint16_t>(half);
+}
+
+float ReducedPrecision::halfToFloat(uint16_t value){
+    uint32_t sign = (static_cast<uint32_t>(value) & 0x8000u) << 16;
+    uint32_t exponent = (value >> 10) & 0x1fu;
+    uint32_t mantissa = value & 0x3ffu;
+    uint32_t bits;
+
+    if(exponent == 0){
+        if(mantissa == 0){
+            bits = sign;
+        }else{
+            // renormalize the subnormal
+            exponent = 127 - 15 + 1;
+            while(!(mantissa & 0x400u)){
+                mantissa <<= 1;
+                --exponent;
+            }
+            bits = sign | (exponent << 23) | ((mantissa & 0x3ffu) << 13);
+        }
+    }else if(exponent == 31){
+        bits = sign | 0x7f800000u | (mantissa << 13) | (mantissa ? 0x400000u : 0u);
+    }else{
+        bits = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+    }
+
+    float result;
+    memcpy(&result, &bits, sizeof(result));
+    return result;
+}
+
+void ReducedPrecision::encode(const float *src, uint16_t *dst, int n, Precision precision){
+    int i = 0;
+    if(precision == Precision::FP16){
+# if defined(__F16C__)
+        for( ; i + 8 <= n ; i += 8){
+            __m128i packed = _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), packed);
+        }
+# endif
+        for( ; i < n ; ++i){
+            dst[i] = floatToHalf(src[i]);
+        }
+    }else if(precision == Precision::BF16){
+# if defined(__AVX512BF16__)
+        // note : the hardware path treats fp32 subnormal inputs as zero
+        for( ; i + 16 <= n ; i += 16){
+            __m256bh packed = _mm512_cvtneps_pbh(_mm512_loadu_ps(src + i));
+            memcpy(dst + i, &packed, sizeof(packed));
+        }
+# endif
+        for( ; i < n ; ++i){
+            dst[i] = floatToBf16(src[i]);
+        }
+    }else{
+        throw invalid_argument("encode: fp32 has no 16-bit storage");
+    }
+}
+
+void ReducedPrecision::decode(const uint16_t *src, float *dst, int n, Precision precision){
+    int i = 0;
+    if(precision == Precision::FP16){
+# if defined(__F16C__)
+        for( ; i + 8 <= n ; i += 8){
+            __m128i packed = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+            _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(packed));
+        }
+# endif
+        for( ; i < n ; ++i){
+            dst[i] = halfToFloat(src[i]);
+        }
+    }else if(precision == Precision::BF16){
+# if defined(__AVX2__)
+        // bf16 is the top half of an fp32 : widen and shift
+        for( ; i + 8 <= n ; i += 8){
+            __m256i wide = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i)));
+            _mm256_storeu_ps(dst + i, _mm256_castsi256_ps(_mm256_slli_epi32(wide, 16)));
+        }
+# endif
+        for( ; i < n ; ++i){
+            dst[i] = bf16ToFloat(src[i]);
+        }
+    }else{
+        throw invalid_argument("decode: fp32 has no 16-bit storage");
+    }
+}
+
+HalfMatrix ReducedPrecision::createMatrix(int rows, int cols, Precision precision){
+    if(precision == Precision::FP32){
+        throw invalid_argument("HalfMatrix needs bf16 or fp16 precision");
+    }
+    HalfMatrix result;
+    result.precision = precision;
+    result.rows = rows;
+    result.cols = cols;
+    result.data.assign(static_cast<size_t>(rows) * cols, 0);
+    ATTN_TRACE_ALLOC(result.data.size() * sizeof(uint16_t));
+    return result;
+}
+
+HalfMatrix ReducedPrecision::quantize(const vector<vector<float>> &M, Precision precision){
+    int rows = M.size();
+    int cols = M.empty() ? 0 : M[0].size();
+    HalfMatrix result = createMatrix(rows, cols, precision);
+    for(int i = 0 ; i < rows ; ++i){
+        encode(M[i].data(), result.row(i), cols, precision);
+    }
+    return result;
+}
+
+vector<vector<float>> ReducedPrecision::dequantize(const HalfMatrix &M){
+    vector<vector<float>> result(M.rows, vector<float>(M.cols));
+    for(int i = 0 ; i < M.rows ; ++i){
+        decode(M.row(i), result[i].data(), M.cols, M.precision);
+    }
+    return result;
+}
+
+namespace{
+
+// rows of B widened per tile; a tile stays hot in cache while every row of A passes over it
+const int K_TILE = 64;
+
+// acc[i * B.cols + j] += sum_k A[i][k] * B[k][j] in fp32, every element of A and B decoded once
+void accumulateProduct(const HalfMatrix &A, const HalfMatrix &B, float *acc){
+    vector<float> b_tile(static_cast<size_t>(K_TILE) * B.cols), a_seg(K_TILE);
+    for(int k0 = 0 ; k0 < A.cols ; k0 += K_TILE){
+        int kn = min(K_TILE, A.cols - k0);
+        for(int kk = 0 ; kk < kn ; ++kk){
+            ReducedPrecision::decode(B.row(k0 + kk), b_tile.data() + static_cast<size_t>(kk) * B.cols, B.cols, B.precision);
+        }
+        for(int i = 0 ; i < A.rows ; ++i){
+            ReducedPrecision::decode(A.row(i) + k0, a_seg.data(), kn, A.precision);
+            float *acc_row = acc + static_cast<size_t>(i) * B.cols;
+            for(int kk = 0 ; kk < kn ; ++kk){
+                float a = a_seg[kk];
+                const float *b_row = b_tile.data() + static_cast<size_t>(kk) * B.cols;
+                for(int j = 0 ; j < B.cols ; ++j){
+                    acc_row[j] += (a * b_row[j]);
+                }
+            }
+        }
+    }
+}
+
+}
+
+HalfMatrix ReducedPrecision::matmul(const HalfMatrix &A, const HalfMatrix &B){
+    if(A.cols != B.rows){
+        throw invalid_argument("matmul: inner dimensions do not match");
+    }
+    HalfMatrix result = createMatrix(A.rows, B.cols, A.precision);
+
+    vector<float> acc(static_cast<size_t>(A.rows) * B.cols, 0.0f);
+    accumulateProduct(A, B, acc.data());
+    for(int i = 0 ; i < A.rows ; ++i){
+        encode(acc.data() + static_cast<size_t>(i) * B.cols, result.row(i), B.cols, result.precision);
+    }
+    return result;
+}
+
+vector<vector<float>> ReducedPrecision::matmulFloat(const HalfMatrix &A, const HalfMatrix &B){
+    if(A.cols != B.rows){
+        throw invalid_argument("matmul: inner dimensions do not match");
+    }
+    vector<float> acc(static_cast<size_t>(A.rows) * B.cols, 0.0f);
+    accumulateProduct(A, B, acc.data());
+
+    vector<vector<float>> result(A.rows);
+    ATTN_TRACE_ALLOC(static_cast<size_t>(A.rows) * B.cols * sizeof(float));
+    for(int i = 0 ; i < A.rows ; ++i){
+        result[i].assign(acc.begin() + static_cast<size_t>(i) * B.cols, acc.begin() + static_cast<size_t>(i + 1) * B.cols);
+    }
+    return result;
+}
+
+vector<vector<float>> ReducedPrecision::matmulTransposed(const HalfMatrix &A, const HalfMatrix &B){
+    if(A.cols != B.cols){
+        throw invalid_argument("matmulTransposed: row lengths do not match");
+    }
+    vector<vector<float>> result(A.rows, vector<float>(B.rows, 0.0f));
+    ATTN_TRACE_ALLOC(static_cast<size_t>(A.rows) * B.rows * sizeof(float));
+
+    // B is decoded once up front : it is re-read for every row of A
+    vector<float> b_all(static_cast<size_t>(B.rows) * B.cols);
+    for(int j = 0 ; j < B.rows ; ++j){
+        decode(B.row(j), b_all.data() + static_cast<size_t>(j) * B.cols, B.cols, B.precision);
+    }
+
+    vector<float> a_row(A.cols);
+    for(int i = 0 ; i < A.rows ; ++i){
+        decode(A.row(i), a_row.data(), A.cols, A.precision);
+        for(int j = 0 ; j < B.rows ; ++j){
+            const float *b_row = b_all.data() + static_cast<size_t>(j) * B.cols;
+            float acc = 0.0f;
+            for(int k = 0 ; k < A.cols ; ++k){
+                acc += (a_row[k] * b_row[k]);
+            }
+            result[i][j] = acc;
+        }
+    }
+    return result;
+}
+
+void ReducedPrecision::matmulInto(const vector<vector<float>> &P, const HalfMatrix &V, HalfMatrix &out, int col_offset){
+    int P_rows = P.size();
+    int P_cols = P.empty() ? 0 : P[0].size();
+    if(P_cols != V.rows || col_offset + V.cols > out.cols || P_rows > out.rows){
+        throw invalid_argument("matmulInto: shape mismatch");
+    }
+
+    // same k-tiling as accumulateProduct : each V row is widened once per call
+    vector<float> acc(static_cast<size_t>(P_rows) * V.cols, 0.0f);
+    vector<float> v_tile(static_cast<size_t>(K_TILE) * V.cols);
+    for(int k0 = 0 ; k0 < P_cols ; k0 += K_TILE){
+        int kn = min(K_TILE, P_cols - k0);
+        for(int kk = 0 ; kk < kn ; ++kk){
+            decode(V.row(k0 + kk), v_tile.data() + static_cast<size_t>(kk) * V.cols, V.cols, V.precision);
+        }
+        for(int i = 0 ; i < P_rows ; ++i){
+            float *acc_row = acc.data() + static_cast<size_t>(i) * V.cols;
+            for(int kk = 0 ; kk < kn ; ++kk){
+                float p = P[i][k0 + kk];
+                const float *v_row = v_tile.data() + static_cast<size_t>(kk) * V.cols;
+                for(int j = 0 ; j < V.cols ; ++j){
+                    acc_row[j] += (p * v_row[j]);
+                }
+            }
+        }
+    }
+
+    for(int i = 0 ; i < P_rows ; ++i){
+        encode(acc.data() + static_cast<size_t>(i) * V.cols, out.row(i) + col_offset, V.cols, out.precision);
+    }
+}
+
+size_t ReducedPrecision::bytesPerElement(Precision precision){
+    return (precision == Precision::FP32) ? sizeof(float) : sizeof(uint16_t);
+}
+
+const char *ReducedPrecision::name(Precision precision){
+    switch(precision){
+        case Precision::BF16: return "bf16";
+        case Precision::FP16: return "fp16";
+        default: return "fp32";
+    }
+}
+
+size_t ReducedPrecision::calculateMemoryKB(const HalfMatrix &M){
+    return ((M.data.size() * sizeof(uint16_t)) / 1024);
+}
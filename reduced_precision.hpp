@@ -0,0 +1,66 @@
+# ifndef REDUCED_PRECISION_HPP
+# define REDUCED_PRECISION_HPP
+
+# include <cstdint>
+# include <cstddef>
+# include <vector>
+
+/* 16-bit storage for weights, activations and K/V.
+
+   Values are stored as bf16 or fp16 and widened to fp32 before any arithmetic :
+   every GEMM and the softmax accumulate in fp32, only the stored result is rounded.
+
+   Conversions use F16C (fp16) and AVX512-BF16 (bf16) when the compiler targets them
+   (g++ -mf16c / -mavx512bf16, or -march=native) and a bit-exact software path otherwise.
+*/
+
+enum class Precision{
+    FP32,
+    BF16,
+    FP16
+};
+
+// row-major [rows x cols] matrix of 16-bit values
+struct HalfMatrix{
+    Precision precision;
+    int rows;
+    int cols;
+    std::vector<uint16_t> data;
+
+    const uint16_t *row(int i) const { return data.data() + static_cast<size_t>(i) * cols; }
+    uint16_t *row(int i) { return data.data() + static_cast<size_t>(i) * cols; }
+};
+
+class ReducedPrecision{
+    public:
+        static uint16_t floatToBf16(float value);
+        static float bf16ToFloat(uint16_t value);
+        static uint16_t floatToHalf(float value);
+        static float halfToFloat(uint16_t value);
+
+        // bulk conversion of n values (vectorized where the target allows it)
+        static void encode(const float *src, uint16_t *dst, int n, Precision precision);
+        static void decode(const uint16_t *src, float *dst, int n, Precision precision);
+
+        static HalfMatrix createMatrix(int rows, int cols, Precision precision);
+        static HalfMatrix quantize(const std::vector<std::vector<float>> &M, Precision precision);
+        static std::vector<std::vector<float>> dequantize(const HalfMatrix &M);
+
+        // (A x B) with fp32 accumulation, rounded into A's precision
+        static HalfMatrix matmul(const HalfMatrix &A, const HalfMatrix &B);
+
+        // (A x B) with fp32 accumulation, kept in fp32
+        static std::vector<std::vector<float>> matmulFloat(const HalfMatrix &A, const HalfMatrix &B);
+
+        // (A x B^T) in fp32 : attention scores from Q and K without materializing K^T
+        static std::vector<std::vector<float>> matmulTransposed(const HalfMatrix &A, const HalfMatrix &B);
+
+        // (P x V) written into columns [col_offset, col_offset + V.cols) of out (one head slice)
+        static void matmulInto(const std::vector<std::vector<float>> &P, const HalfMatrix &V, HalfMatrix &out, int col_offset);
+
+        static size_t bytesPerElement(Precision precision);
+        static const char *name(Precision precision);
+        static size_t calculateMemoryKB(const HalfMatrix &M);
+};
+
+# endif
@@ -0,0 +1,459 @@
+# include "tensor_parallel.hpp"
+# include "attention_trace.hpp"
+
+# include <algorithm>
+# include <cerrno>
+# include <cmath>
+# include <ctime>
+# include <stdexcept>
+# include <string>
+
+# ifndef _WIN32
+# include <fcntl.h>
+# include <semaphore.h>
+# include <signal.h>
+# include <sys/mman.h>
+# include <sys/wait.h>
+# include <unistd.h>
+# endif
+
+using namespace std;
+
+/*LOGIC FOR:
+
+1] AttentionShard::forwardPartial (local heads -> local W_o rows), fp32 and 16-bit
+2] shared segment setup (shm_open + mmap, process-shared semaphores), worker fork and startup handshake
+3] forward : publish X, partials, reduce-scatter, read result
+4] rank synchronization, failure handling (status words, dead workers) and shutdown
+
+*/
+
+void AttentionShard::validate() const{
+    if(num_heads <= 0 || num_kv_heads <= 0 || (num_heads % num_kv_heads) != 0){
+        throw invalid_argument("shard needs num_kv_heads > 0 dividing num_heads");
+    }
+    auto check = [this](const vector<vector<vector<float>>> &W, int count, int cols){
+        if(static_cast<int>(W.size()) != count){
+            return false;
+        }
+        for(const auto &w : W){
+            if(static_cast<int>(w.size()) != d_model || static_cast<int>(w[0].size()) != cols){
+                return false;
+            }
+        }
+        return true;
+    };
+    if(!check(W_q, num_heads, d_k) || !check(W_k, num_kv_heads, d_k) || !check(W_v, num_kv_heads, d_v)){
+        throw invalid_argument("shard projection weights do not match its head counts and d_model");
+    }
+    if(static_cast<int>(W_o.size()) != num_heads * d_v || static_cast<int>(W_o[0].size()) != d_model){
+        throw invalid_argument("shard W_o must have num_heads * d_v rows of d_model");
+    }
+    if(precision != Precision::FP32 &&
+       (static_cast<int>(W_q_half.size()) != num_heads || static_cast<int>(W_k_half.size()) != num_kv_heads ||
+        static_cast<int>(W_v_half.size()) != num_kv_heads || W_o_half.rows != num_heads * d_v)){
+        throw invalid_argument("shard 16-bit weights do not match its head counts");
+    }
+}
+
+vector<vector<float>> AttentionShard::forwardPartial(const vector<vector<float>> &X) const{
+    validate();
+    if(precision != Precision::FP32){
+        return forwardPartialReducedPrecision(X);
+    }
+    ATTN_TRACE_SCOPE("tp", "forward_partial", -1);
+    int seq_len = X.size();
+    int heads_per_group = num_heads / num_kv_heads;
+    float scale = 1.0f / std::sqrt(static_cast<float>(d_k));
+
+    vector<vector<vector<float>>> K_groups, V_groups;
+    for(int kvh = 0 ; kvh < num_kv_heads ; ++kvh){
+        K_groups.push_back(AttentionCommon::matmul(X, W_k[kvh]));
+        V_groups.push_back(AttentionCommon::matmul(X, W_v[kvh]));
+    }
+
+    // [seq, local heads, d_v]
+    vector<vector<float>> heads(seq_len, vector<float>(num_heads * d_v, 0.0f));
+    for(int h = 0 ; h < num_heads ; ++h){
+        int curr_group_idx = (h / heads_per_group);
+        auto Q = AttentionCommon::matmul(X, W_q[h]);
+        auto scores = AttentionCommon::matmul(Q, AttentionCommon::transpose(K_groups[curr_group_idx]));
+        for (auto& row : scores) {
+            for (auto& val : row) {
+                val *= scale;
+            }
+        }
+        auto attention_weights = AttentionCommon::softmax(scores);
+        AttentionCommon::matmulInto(attention_weights, V_groups[curr_group_idx], HeadView{&heads, h * d_v, d_v});
+    }
+    return AttentionCommon::matmul(heads, W_o);
+}
+
+vector<vector<float>> AttentionShard::forwardPartialReducedPrecision(const vector<vector<float>> &X) const{
+    ATTN_TRACE_SCOPE("tp", "forward_partial_reduced_precision", -1);
+    int seq_len = X.size();
+    int heads_per_group = num_heads / num_kv_heads;
+    float scale = 1.0f / std::sqrt(static_cast<float>(d_k));
+    auto X_half = ReducedPrecision::quantize(X, precision);
+
+    vector<HalfMatrix> K_groups, V_groups;
+    for(int kvh = 0 ; kvh < num_kv_heads ; ++kvh){
+        K_groups.push_back(ReducedPrecision::matmul(X_half, W_k_half[kvh]));
+        V_groups.push_back(ReducedPrecision::matmul(X_half, W_v_half[kvh]));
+    }
+
+    auto heads = ReducedPrecision::createMatrix(seq_len, num_heads * d_v, precision);
+    for(int h = 0 ; h < num_heads ; ++h){
+        int curr_group_idx = (h / heads_per_group);
+        auto Q = ReducedPrecision::matmul(X_half, W_q_half[h]);
+        auto scores = ReducedPrecision::matmulTransposed(Q, K_groups[curr_group_idx]);
+        for (auto& row : scores) {
+            for (auto& val : row) {
+                val *= scale;
+            }
+        }
+        auto attention_weights = AttentionCommon::softmax(scores);
+        ReducedPrecision::matmulInto(attention_weights, V_groups[curr_group_idx], heads, h * d_v);
+    }
+    return ReducedPrecision::matmulFloat(heads, W_o_half);
+}
+
+# ifndef _WIN32
+
+namespace{
+
+const int MAX_RANKS = 256;
+
+const int COMMAND_RUN = 0;
+const int COMMAND_EXIT = 1;
+
+const int STATUS_OK = 0;
+const int STATUS_FAILED = 1;
+
+size_t alignUp(size_t bytes){
+    return (bytes + 63) & ~static_cast<size_t>(63);
+}
+
+int segment_counter = 0;
+
+// how often rank 0, while waiting for the workers, checks that none of them has died
+const long POLL_NS = 50 * 1000 * 1000L;
+
+string describeExit(int rank, int status){
+    string what = WIFSIGNALED(status) ? ("was killed by signal " + to_string(WTERMSIG(status)))
+                                      : ("exited with status " + to_string(WEXITSTATUS(status)));
+    return "tensor-parallel rank " + to_string(rank) + " " + what;
+}
+
+}
+
+/* Ranks meet at syncRanks() : each worker posts 'arrived' and blocks on its own 'depart';
+   rank 0 collects world - 1 arrivals, then posts every 'depart'. Rank 0 waits with
+   sem_timedwait, so a worker killed by a signal (which can never arrive) is noticed
+   through waitpid instead of hanging the caller, as a process-shared barrier would. */
+struct SharedControl{
+    sem_t arrived;
+    sem_t depart[MAX_RANKS];
+    int command;
+    int seq_len;
+    int status[MAX_RANKS];      // written by each rank before a sync, read by every rank after it
+};
+
+TensorParallelAttention::TensorParallelAttention(int world, int d_model, int max_seq_len, const function<AttentionShard(int)> &make_shard)
+: world(world), d_model(d_model), max_seq_len(max_seq_len), region(nullptr), region_bytes(0), control(nullptr){
+    if(world < 1 || world > MAX_RANKS || max_seq_len < 1){
+        throw invalid_argument("world size must be in [1, " + to_string(MAX_RANKS) + "] and max_seq_len positive");
+    }
+
+    // rank 0 is built first so a bad split throws here, before any process exists
+    shard = make_shard(0);
+    shard.validate();
+
+    matrix_stride = alignUp(static_cast<size_t>(max_seq_len) * d_model * sizeof(float)) / sizeof(float);
+    size_t control_bytes = alignUp(sizeof(SharedControl));
+    region_bytes = control_bytes + (world + 2) * matrix_stride * sizeof(float);
+
+    string name = "/attention_tp_" + to_string(getpid()) + "_" + to_string(segment_counter++);
+    int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if(fd < 0){
+        throw runtime_error("shm_open failed for " + name);
+    }
+    if(ftruncate(fd, region_bytes) != 0){
+        close(fd);
+        shm_unlink(name.c_str());
+        throw runtime_error("cannot size shared segment " + name);
+    }
+    region = mmap(nullptr, region_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    // the name is dropped at once : forked ranks inherit the mapping, nothing outlives the processes
+    shm_unlink(name.c_str());
+    if(region == MAP_FAILED){
+        region = nullptr;
+        throw runtime_error("cannot map shared segment " + name);
+    }
+
+    control = static_cast<SharedControl*>(region);
+    sem_init(&control->arrived, 1, 0);
+    for(int r = 0 ; r < world ; ++r){
+        sem_init(&control->depart[r], 1, 0);
+    }
+    control->command = COMMAND_RUN;
+    control->seq_len = 0;
+    fill(control->status, control->status + world, STATUS_OK);
+
+    input = reinterpret_cast<float*>(static_cast<char*>(region) + control_bytes);
+    partials = input + matrix_stride;
+    result = partials + world * matrix_stride;
+
+    for(int rank = 1 ; rank < world ; ++rank){
+        pid_t pid = fork();
+        if(pid < 0){
+            // the ranks already started would wait for the handshake forever
+            stopWorkers();
+            releaseSegment();
+            throw runtime_error("fork failed while starting tensor-parallel ranks");
+        }
+        if(pid == 0){
+            // worker : swap in its own shard, serve forward() calls, never return to the caller
+            try{
+                shard = make_shard(rank);
+                shard.validate();
+            }catch(...){
+                control->status[rank] = STATUS_FAILED;
+            }
+            syncRanks(rank);                              // startup handshake, joined even on failure
+            if(control->status[rank] != STATUS_OK){
+                _exit(1);
+            }
+            workerLoop(rank);
+            _exit(0);
+        }
+        worker_pids.push_back(pid);
+    }
+
+    // every rank has built its shard (or reported that it could not, or died)
+    try{
+        syncRanks(0);
+    }catch(...){
+        releaseSegment();
+        throw;
+    }
+    int failed = failedRank();
+    if(failed >= 0){
+        stopWorkers();
+        releaseSegment();
+        throw runtime_error("tensor-parallel rank " + to_string(failed) + " could not build its shard");
+    }
+}
+
+TensorParallelAttention::~TensorParallelAttention(){
+    if(!control){ return; }
+
+    // after stopWorkers() there is nobody to tell
+    if(static_cast<int>(worker_pids.size()) == world - 1){
+        control->command = COMMAND_EXIT;
+        try{
+            syncRanks(0);
+        }catch(...){
+            // a worker died meanwhile : syncRanks already stopped the rest
+        }
+        for(int pid : worker_pids){
+            waitpid(pid, nullptr, 0);
+        }
+    }
+    releaseSegment();
+}
+
+vector<vector<float>> TensorParallelAttention::forward(const vector<vector<float>> &X){
+    int seq_len = X.size();
+    if(seq_len > max_seq_len || (seq_len > 0 && static_cast<int>(X[0].size()) != d_model)){
+        throw invalid_argument("input does not fit the tensor-parallel segment");
+    }
+    if(static_cast<int>(worker_pids.size()) != world - 1){
+        throw runtime_error("tensor-parallel ranks were stopped after an earlier failure");
+    }
+    if(seq_len == 0){
+        return {};
+    }
+
+    for(int i = 0 ; i < seq_len ; ++i){
+        copy(X[i].begin(), X[i].end(), input + static_cast<size_t>(i) * d_model);
+    }
+    control->seq_len = seq_len;
+    control->command = COMMAND_RUN;
+
+    syncRanks(0);                                     // release the workers
+    exception_ptr error = runRank(0);
+
+    int failed = failedRank();
+    if(failed >= 0){
+        // the workers are parked on the next command sync : nothing more will come from them
+        stopWorkers();
+        if(error){
+            rethrow_exception(error);
+        }
+        throw runtime_error("tensor-parallel rank " + to_string(failed) + " failed in forwardPartial");
+    }
+
+    vector<vector<float>> output(seq_len, vector<float>(d_model));
+    for(int i = 0 ; i < seq_len ; ++i){
+        copy(result + static_cast<size_t>(i) * d_model, result + static_cast<size_t>(i + 1) * d_model, output[i].begin());
+    }
+    return output;
+}
+
+void TensorParallelAttention::workerLoop(int rank){
+    for(;;){
+        syncRanks(rank);                              // wait for the next command
+        if(control->command == COMMAND_EXIT){
+            return;
+        }
+        runRank(rank);
+    }
+}
+
+int TensorParallelAttention::failedRank() const{
+    for(int r = 0 ; r < world ; ++r){
+        if(control->status[r] != STATUS_OK){
+            return r;
+        }
+    }
+    return -1;
+}
+
+void TensorParallelAttention::stopWorkers(){
+    for(int pid : worker_pids){
+        kill(pid, SIGKILL);
+        waitpid(pid, nullptr, 0);
+    }
+    worker_pids.clear();
+}
+
+void TensorParallelAttention::syncRanks(int rank){
+    if(rank != 0){
+        sem_post(&control->arrived);
+        while(sem_wait(&control->depart[rank]) != 0 && errno == EINTR){}
+        return;
+    }
+
+    for(int arrived = 0 ; arrived < world - 1 ; ){
+        timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += POLL_NS;
+        if(deadline.tv_nsec >= 1000000000L){
+            deadline.tv_sec += 1;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        if(sem_timedwait(&control->arrived, &deadline) == 0){
+            ++arrived;
+            continue;
+        }
+        if(errno != ETIMEDOUT){
+            continue;       // EINTR
+        }
+
+        // a worker that is gone will never arrive : stop the others and report it
+        for(size_t i = 0 ; i < worker_pids.size() ; ++i){
+            int status = 0;
+            if(waitpid(worker_pids[i], &status, WNOHANG) == worker_pids[i]){
+                worker_pids.erase(worker_pids.begin() + i);
+                stopWorkers();
+                throw runtime_error(describeExit(static_cast<int>(i) + 1, status));
+            }
+        }
+    }
+    for(int r = 1 ; r < world ; ++r){
+        sem_post(&control->depart[r]);
+    }
+}
+
+void TensorParallelAttention::releaseSegment(){
+    // no process is blocked on the semaphores any more : workers have exited or were killed
+    sem_destroy(&control->arrived);
+    for(int r = 0 ; r < world ; ++r){
+        sem_destroy(&control->depart[r]);
+    }
+    munmap(region, region_bytes);
+    control = nullptr;
+}
+
+exception_ptr TensorParallelAttention::runRank(int rank){
+    int seq_len = control->seq_len;
+    size_t n = static_cast<size_t>(seq_len) * d_model;
+
+    // a failing rank still takes both syncs below, so the others never wait on it
+    exception_ptr error;
+    try{
+        vector<vector<float>> X(seq_len);
+        for(int i = 0 ; i < seq_len ; ++i){
+            X[i].assign(input + static_cast<size_t>(i) * d_model, input + static_cast<size_t>(i + 1) * d_model);
+        }
+
+        auto partial = shard.forwardPartial(X);
+        float *mine = partials + rank * matrix_stride;
+        for(int i = 0 ; i < seq_len ; ++i){
+            copy(partial[i].begin(), partial[i].end(), mine + static_cast<size_t>(i) * d_model);
+        }
+    }catch(...){
+        control->status[rank] = STATUS_FAILED;
+        error = current_exception();
+    }
+    syncRanks(rank);                                  // every partial is published (or a failure reported)
+
+    if(failedRank() >= 0){
+        syncRanks(rank);
+        return error;
+    }
+
+    // reduce-scatter : this rank owns one contiguous slice of the output
+    ATTN_TRACE_BEGIN(reduce_span, "tp", "all_reduce", rank);
+    size_t lo = (n * rank) / world;
+    size_t hi = (n * (rank + 1)) / world;
+    for(size_t idx = lo ; idx < hi ; ++idx){
+        float sum = 0.0f;
+        for(int r = 0 ; r < world ; ++r){
+            sum += partials[r * matrix_stride + idx];
+        }
+        result[idx] = sum;
+    }
+    ATTN_TRACE_END(reduce_span);
+    syncRanks(rank);                                  // result complete in shared memory
+    return error;
+}
+
+# else
+
+struct SharedControl{};
+
+TensorParallelAttention::TensorParallelAttention(int world, int d_model, int max_seq_len, const function<AttentionShard(int)> &)
+: world(world), d_model(d_model), max_seq_len(max_seq_len), region(nullptr), region_bytes(0), control(nullptr){
+    throw runtime_error("tensor-parallel attention needs POSIX shared memory and fork()");
+}
+
+TensorParallelAttention::~TensorParallelAttention(){}
+
+vector<vector<float>> TensorParallelAttention::forward(const vector<vector<float>> &){
+    return {};
+}
+
+void TensorParallelAttention::workerLoop(int){}
+
+exception_ptr TensorParallelAttention::runRank(int){
+    return nullptr;
+}
+
+int TensorParallelAttention::failedRank() const{
+    return -1;
+}
+
+void TensorParallelAttention::stopWorkers(){}
+
+void TensorParallelAttention::syncRanks(int){}
+
+void TensorParallelAttention::releaseSegment(){}
+
+# endif
+
+int TensorParallelAttention::worldSize() const{
+    return world;
+}
@@ -0,0 +1,97 @@
+# ifndef TENSOR_PARALLEL_HPP
+# define TENSOR_PARALLEL_HPP
+
+# include "attention_common.hpp"
+# include "reduced_precision.hpp"
+# include <vector>
+# include <functional>
+# include <exception>
+
+/* One tensor-parallel slice of an attention layer : a contiguous run of query heads,
+   the K/V heads they read, and the matching rows of W_o.
+
+   Built by makeShard(rank, world) on MultiHeadAttention / MultiQueryAttention /
+   GroupedQueryAttention. Summing forwardPartial() over all shards gives forward(), in the
+   storage precision the layer was set to. */
+struct AttentionShard{
+    int d_model;
+    int num_heads;          // local query heads
+    int num_kv_heads;       // local K/V heads (MQA : the single shared head, replicated)
+    int d_k;
+    int d_v;
+
+    std::vector<std::vector<std::vector<float>>> W_q;     // [num_heads][d_model][d_k]
+    std::vector<std::vector<std::vector<float>>> W_k;     // [num_kv_heads][d_model][d_k]
+    std::vector<std::vector<std::vector<float>>> W_v;     // [num_kv_heads][d_model][d_v]
+    std::vector<std::vector<float>> W_o;                  // [num_heads * d_v][d_model]
+
+    // bf16 / fp16 : the same slices in 16-bit storage (empty for fp32)
+    Precision precision = Precision::FP32;
+    std::vector<HalfMatrix> W_q_half;
+    std::vector<HalfMatrix> W_k_half;
+    std::vector<HalfMatrix> W_v_half;
+    HalfMatrix W_o_half;
+
+    // throws invalid_argument unless the head counts and weight shapes agree
+    void validate() const;
+
+    // this shard's heads pushed through its W_o rows : [seq, d_model] (validates first)
+    std::vector<std::vector<float>> forwardPartial(const std::vector<std::vector<float>> &X) const;
+
+    // forwardPartial with 16-bit X, K/V and heads, fp32 scores (as forwardReducedPrecision)
+    std::vector<std::vector<float>> forwardPartialReducedPrecision(const std::vector<std::vector<float>> &X) const;
+};
+
+/* Runs one shard per process on the same host (POSIX only).
+
+   The constructor forks world - 1 worker processes; the calling process is rank 0.
+   Each forward() publishes X in a POSIX shared-memory segment, every rank computes its
+   partial output, and the partials are combined with a reduce-scatter over the segment
+   (rank r sums the r-th slice of every partial), which leaves the all-reduced result in
+   shared memory for rank 0 to read. Ranks synchronize through process-shared semaphores.
+
+   A rank that throws (in make_shard, validate or forwardPartial) marks its status word in
+   the segment and still joins every sync of that round, so nobody is left waiting. Rank 0
+   checks the status words after the startup handshake and after every forward(), and
+   polls waitpid while it waits, so a worker killed by a signal is noticed too. On any
+   failure it kills and reaps the workers and throws; the object is unusable afterwards. */
+class TensorParallelAttention{
+    public:
+        // make_shard(rank) is called once inside each process, after the fork
+        TensorParallelAttention(int world, int d_model, int max_seq_len, const std::function<AttentionShard(int)> &make_shard);
+        ~TensorParallelAttention();
+
+        TensorParallelAttention(const TensorParallelAttention&) = delete;
+        TensorParallelAttention &operator=(const TensorParallelAttention&) = delete;
+
+        std::vector<std::vector<float>> forward(const std::vector<std::vector<float>> &X);
+
+        int worldSize() const;
+
+    private:
+        // nullptr when this rank's partial was published
+        std::exception_ptr runRank(int rank);
+        void workerLoop(int rank);
+        int failedRank() const;         // lowest rank whose status word is set, -1 if none
+        void stopWorkers();             // SIGKILL and reap every worker
+        void syncRanks(int rank);       // all ranks meet; rank 0 throws if a worker died
+        void releaseSegment();          // destroy the semaphores and unmap
+
+        int world;
+        int d_model;
+        int max_seq_len;
+        AttentionShard shard;
+
+        // shared segment : control block, X, one partial per rank, reduced result
+        void *region;
+        size_t region_bytes;
+        struct SharedControl *control;
+        float *input;
+        float *partials;
+        float *result;
+        size_t matrix_stride;       // floats between consecutive matrices in the segment
+
+        std::vector<int> worker_pids;
+};
+
+# endif
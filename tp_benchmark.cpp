@@ -0,0 +1,83 @@
+/* Tensor-parallel scaling benchmark (Linux).
+
+   Build :
+   g++ -std=c++14 -O2 -pthread -o tp_benchmark tp_benchmark.cpp attention_common.cpp mha.cpp mqa.cpp gqa.cpp
+       attention_trace.cpp reduced_precision.cpp embedding_stream.cpp kv_cache.cpp block_sparse.cpp tensor_parallel.cpp -lrt
+
+   Usage : tp_benchmark [seq_len] [repeats]
+
+   For every variant and 1, 2, 4, 8 shards it prints the time per forward, the speedup
+   over one shard and the max |delta| against the single-process forward().
+*/
+
+#include "mha.hpp"
+#include "mqa.hpp"
+#include "gqa.hpp"
+#include "tensor_parallel.hpp"
+
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+template <typename Attention>
+void benchmarkVariant(Attention &attention, const vector<vector<float>> &X, int repeats, const string &label){
+    auto reference = attention.forward(X);
+    double single_shard_ms = 0.0;
+
+    cout << "--- " << label << " ---\n";
+    for(int world : {1, 2, 4, 8}){
+        TensorParallelAttention tp(world, X[0].size(), X.size(), [&attention, world](int rank){
+            return attention.makeShard(rank, world);
+        });
+
+        auto output = tp.forward(X);          // warm-up (first touch of the segment)
+        auto start = chrono::steady_clock::now();
+        for(int r = 0 ; r < repeats ; ++r){
+            output = tp.forward(X);
+        }
+        double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() / repeats;
+        if(world == 1){
+            single_shard_ms = ms;
+        }
+
+        cout << "shards=" << world
+             << "  " << fixed << setprecision(2) << ms << " ms/forward"
+             << "  speedup x" << (single_shard_ms / ms);
+        cout.unsetf(ios::fixed);
+        cout << setprecision(6) << "  max |delta| = " << AttentionCommon::maxAbsDiff(reference, output) << "\n";
+    }
+    cout << "\n";
+}
+
+int main(int argc, char **argv){
+    const int D_MODEL = 512;
+    const int NUM_HEADS = 16;
+    const int NUM_KV_HEADS = 8;
+    int seq_len = (argc > 1) ? atoi(argv[1]) : 128;
+    int repeats = (argc > 2) ? atoi(argv[2]) : 3;
+
+    cout << "=======    TENSOR-PARALLEL ATTENTION SCALING    ======\n";
+    cout << "d_model=" << D_MODEL << " heads=" << NUM_HEADS << " kv_heads(GQA)=" << NUM_KV_HEADS
+         << " seq_len=" << seq_len << " repeats=" << repeats
+         << " cores=" << thread::hardware_concurrency() << "\n\n";
+
+    string text;
+    for(int i = 0 ; i < seq_len ; ++i){
+        text += static_cast<char>('a' + (i * 7) % 26);
+    }
+    auto X = AttentionCommon::textToEmbedding(text, D_MODEL);
+
+    MultiHeadAttention mha(NUM_HEADS, D_MODEL);
+    benchmarkVariant(mha, X, repeats, "MHA");
+
+    MultiQueryAttention mqa(NUM_HEADS, D_MODEL);
+    benchmarkVariant(mqa, X, repeats, "MQA");
+
+    GroupedQueryAttention gqa(NUM_HEADS, NUM_KV_HEADS, D_MODEL);
+    benchmarkVariant(gqa, X, repeats, "GQA");
+}